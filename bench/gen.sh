@@ -0,0 +1,119 @@
+#!/bin/sh
+# gen.sh - write a generated benchmark input to standard output
+#
+# Usage: bench/gen.sh NAME [N]
+# Every input is the same for the same NAME and N (awk's srand(1)), so runs on
+# different builds or revisions see identical text. N scales the input; each
+# NAME has a default near the size its benchmark was first measured at.
+#
+#   dense N       lines of ifs, arithmetic and prints (33 MB)
+#   comments N    indented line and block comments around a few statements (25 MB)
+#   identifiers N keywords and identifiers only, one to eight to a line (22 MB)
+#   prog N        N declarations, each assigned and tested (3000: 165 KB)
+#   few N         three variables and N rounds of expressions and calls (8.5 MB)
+#   brace N       N nested { }
+#   if N          N nested ifs
+#   mixed N       N nested { if while repeat, in turn
+#   flat N        N top-level variables, each assigned and read
+#   deep N        N nested blocks declaring one variable each
+#   wide N        N/10 sibling blocks of 10 variables under 1000 globals
+#   outline N     N while loops of 200 blocks each (12 MB)
+
+name=$1
+n=$2
+case "$name" in
+dense)        n=${n:-600000} ;;
+comments)     n=${n:-190000} ;;
+identifiers)  n=${n:-880000} ;;
+prog)         n=${n:-3000} ;;
+few)          n=${n:-72000} ;;
+brace|if|mixed) n=${n:-1000000} ;;
+flat)         n=${n:-100000} ;;
+deep)         n=${n:-20000} ;;
+wide)         n=${n:-100000} ;;
+outline)      n=${n:-1050} ;;
+*)
+    echo "usage: $0 dense|comments|identifiers|prog|few|brace|if|mixed|flat|deep|wide|outline [N]" >&2
+    exit 2
+    ;;
+esac
+
+exec awk -v name="$name" -v n="$n" '
+function pick(list,    parts, k) {
+    k = split(list, parts, " ")
+    return parts[int(rand() * k) + 1]
+}
+BEGIN {
+    srand(1)
+    if (name == "dense") {
+        for (i = 0; i < n; i++) {
+            printf "if (a%d %s b) { x = (y + %d) * z; print \"s%d\"; }\n",
+                   int(rand() * 100), pick("+ - * / % == <"), int(rand() * 100000), i
+        }
+    } else if (name == "comments") {
+        for (i = 0; i < n; i++) {
+            print "        // " pick("what the next loop does and why it stops there")
+            print "    /* a block comment"
+            print "       over two lines */"
+            print "        // c"
+            print "            /* b */ /* b */ /* b */"
+            printf "    x%d = x%d + 1;\n", i % 50, i % 50
+            print ""
+        }
+    } else if (name == "identifiers") {
+        words = "if int print while repeat until x counter value_1 i total factorial index tmp"
+        for (i = 0; i < n; i++) {
+            line = pick(words)
+            for (k = int(rand() * 8); k > 0; k--) line = line " " pick(words)
+            print line
+        }
+    } else if (name == "prog") {
+        for (i = 0; i < n; i++) {
+            printf "int v%d;\nv%d = %d + 1;\nif (v%d) { print v%d; }\n", i, i, i, i, i
+        }
+    } else if (name == "few") {
+        print "int a;\nint b;\nint c;\na = 1;\nb = 2;\nc = 3;"
+        for (i = 0; i < n; i++) {
+            printf "a = a + b * (c - %d) / 2;\n", i * 4
+            print "if (a) { print b + c; }"
+            print "while (b) { c = factorial(a); }"
+            print "print a * b + c - factorial(3);"
+        }
+    } else if (name == "brace" || name == "if" || name == "mixed") {
+        split("{ |if (x) |while (x > 0) |repeat ", opener, "|")
+        print "int x;\nx = 1;"
+        for (i = 0; i < n; i++) {
+            if (name == "brace") printf "{"
+            else if (name == "if") printf "if (x) "
+            else printf "%s", opener[i % 4 + 1]
+        }
+        printf "x = x - 1; "
+        for (i = n - 1; i >= 0; i--) {
+            if (name == "brace") printf "}"
+            else if (name == "mixed" && i % 4 == 0) printf "} "
+            else if (name == "mixed" && i % 4 == 3) printf "until (x == 0) "
+        }
+        if (name == "if") printf "print x;"
+        print ""
+    } else if (name == "flat") {
+        for (i = 0; i < n; i++) printf "int v%d; v%d = %d;\n", i, i, i
+        for (i = 1; i < n; i++) printf "print v%d + v%d;\n", i, i - 1
+    } else if (name == "deep") {
+        for (i = 0; i < n; i++) printf "{ int v%d; v%d = %d; print v0 + v%d;\n", i, i, i, int(i / 2)
+        for (i = 0; i < n; i++) printf "}"
+        print ""
+    } else if (name == "wide") {
+        for (i = 0; i < 1000; i++) printf "int g%d; g%d = 1;\n", i, i
+        for (b = 0; b < n / 10; b++) {
+            printf "{"
+            for (j = 0; j < 10; j++) printf " int a%d; a%d = g%d;", j, j, (b + j) % 1000
+            print " }"
+        }
+    } else if (name == "outline") {
+        for (v = 0; v < n; v++) {
+            printf "int v%d;\nv%d = 0;\nwhile (v%d < 100) {", v, v, v
+            for (j = 0; j < 200; j++) printf " { v%d = v%d + %d * 2; if (v%d > 3) { print v%d; } }", v, v, j, v, v
+            print " }"
+        }
+    }
+}'
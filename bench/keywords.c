@@ -0,0 +1,130 @@
+/* keywords.c - cost of telling keywords from identifiers
+ *
+ * Classifies a random mix of keywords and identifiers, lexemes that are not
+ * '\0' terminated like the lexer's, with the perfect hash the lexer uses and
+ * with the two ways it was done before: strcmp on a copy of the lexeme, and a
+ * chain of length-filtered memcmps. Prints the best of 7 passes over 4M words.
+ *
+ * Build and run (bench/run.sh keywords does this):
+ *   gcc -O2 -o keywords bench/keywords.c src/lexer/scan.c src/lexer/utf8.c src/source/lines.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// classify_word is static, so the lexer is compiled in with the benchmark
+#include "../src/lexer/lexer.c"
+
+#define WORDS (1 << 22)
+#define PASSES 7
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// What the lexer did first: copy the lexeme to terminate it, then strcmp
+__attribute__((noinline))
+static TokenType classify_strcmp(const char* lexeme, uint32_t length) {
+    char word[64];
+    if (length >= sizeof(word)) {
+        return TOKEN_IDENTIFIER;
+    }
+    memcpy(word, lexeme, length);
+    word[length] = '\0';
+    if (strcmp(word, "if") == 0) return TOKEN_IF;
+    if (strcmp(word, "int") == 0) return TOKEN_INT;
+    if (strcmp(word, "print") == 0) return TOKEN_PRINT;
+    if (strcmp(word, "while") == 0) return TOKEN_WHILE;
+    if (strcmp(word, "repeat") == 0) return TOKEN_REPEAT;
+    if (strcmp(word, "until") == 0) return TOKEN_UNTIL;
+    return TOKEN_IDENTIFIER;
+}
+
+static int lexeme_is(const char* lexeme, uint32_t length, const char* word) {
+    return strlen(word) == length && memcmp(lexeme, word, length) == 0;
+}
+
+// Each keyword in turn, its length compared before its bytes
+__attribute__((noinline))
+static TokenType classify_memcmp(const char* lexeme, uint32_t length) {
+    if (lexeme_is(lexeme, length, "if")) return TOKEN_IF;
+    if (lexeme_is(lexeme, length, "int")) return TOKEN_INT;
+    if (lexeme_is(lexeme, length, "print")) return TOKEN_PRINT;
+    if (lexeme_is(lexeme, length, "while")) return TOKEN_WHILE;
+    if (lexeme_is(lexeme, length, "repeat")) return TOKEN_REPEAT;
+    if (lexeme_is(lexeme, length, "until")) return TOKEN_UNTIL;
+    return TOKEN_IDENTIFIER;
+}
+
+__attribute__((noinline))
+static TokenType classify_hash(const char* lexeme, uint32_t length) {
+    return classify_word(lexeme, length);
+}
+
+typedef struct {
+    const char* name;
+    TokenType (*classify)(const char* lexeme, uint32_t length);
+} Method;
+
+static const Method methods[] = {
+    {"strcmp on a copied lexeme", classify_strcmp},
+    {"length-filtered memcmp chain", classify_memcmp},
+    {"perfect hash (lexer.c)", classify_hash},
+};
+
+int main(void) {
+    static const char* vocabulary[] = {
+        "if", "int", "print", "while", "repeat", "until",
+        "x", "counter", "value_1", "i", "total", "factorial", "index", "tmp",
+        "whale", "prin", "untie", "repeal",
+    };
+    size_t choices = sizeof(vocabulary) / sizeof(vocabulary[0]);
+
+    // The words are laid out in one buffer with a space after each, so no
+    // lexeme is followed by its terminator
+    const char** words = malloc(WORDS * sizeof(char*));
+    uint32_t* lengths = malloc(WORDS * sizeof(uint32_t));
+    char* text = malloc(WORDS * 10);
+    if (!words || !lengths || !text) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    char* p = text;
+    srand(1);
+    for (size_t i = 0; i < WORDS; i++) {
+        const char* word = vocabulary[rand() % choices];
+        lengths[i] = (uint32_t)strlen(word);
+        memcpy(p, word, lengths[i]);
+        words[i] = p;
+        p += lengths[i];
+        *p++ = ' ';
+    }
+
+    long keywords = -1;
+    for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+        double best = 1e30;
+        long found = 0;
+        for (int pass = 0; pass < PASSES; pass++) {
+            found = 0;
+            double start = now_seconds();
+            for (size_t i = 0; i < WORDS; i++) {
+                found += methods[m].classify(words[i], lengths[i]) != TOKEN_IDENTIFIER;
+            }
+            double seconds = now_seconds() - start;
+            if (seconds < best) {
+                best = seconds;
+            }
+        }
+        // all three must find the same keywords
+        if (keywords >= 0 && found != keywords) {
+            fprintf(stderr, "%s finds %ld keywords, not %ld\n", methods[m].name, found, keywords);
+            return 1;
+        }
+        keywords = found;
+        printf("  %-30s %6.1f ns/identifier\n", methods[m].name, best * 1e9 / WORDS);
+    }
+    return 0;
+}
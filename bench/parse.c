@@ -0,0 +1,127 @@
+/* parse.c - parser timing and allocations, without the rest of the driver
+ *
+ * Lexes a file once, then parses it rounds times into the same AST and
+ * reports the best parse time, how many allocations the first parse and the
+ * later ones made, and how long it takes to free the tree. The driver only
+ * reports the parse time, and a crash in a later phase would hide it.
+ *
+ * The last line is a hash of the node arrays, so two builds (e.g. with and
+ * without -DPARSER_STACK) can be checked to make the same tree.
+ *
+ * Build it with the sources of src/lexer, src/parser, src/source and src/intern
+ * and -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc; bench/run.sh parser and
+ * bench/run.sh alloc do this.
+ * Usage: parse FILE [ROUNDS]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../include/source.h"
+#include "../include/intern.h"
+#include "../include/lexer.h"
+#include "../include/parser.h"
+
+// Allocation counting, through the linker's --wrap
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+static long allocations;
+
+void* __wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+    allocations++;
+    return __real_realloc(p, size);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// FNV-1a over the node arrays
+static unsigned long long hash_tree(const AST* ast) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (size_t i = 0; i < ast->count; i++) {
+        unsigned long long v = ast->kind[i] + 7ULL * ast->child[i] + 131ULL * ast->sibling[i] +
+                               8191ULL * ast->token[i] + 524287ULL * (unsigned)ast->name[i];
+        h = (h ^ v) * 1099511628211ULL;
+    }
+    return h;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s file [rounds]\n", argv[0]);
+        return 2;
+    }
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    if (rounds < 1) {
+        rounds = 1;
+    }
+
+    SourceFile src;
+    if (source_open(&src, argv[1]) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    TokenBuffer tokens;
+    token_buffer_init(&tokens, src.data);
+    if (!token_buffer_lex(&tokens, src.data, src.size)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    AST ast;
+    ast_init(&ast);
+    double best = 1e30;
+    long first_allocations = 0;
+    long later_allocations = 0;
+    for (int round = 0; round < rounds; round++) {
+        ast_reset(&ast);
+        parser_init_tokens(&tokens);
+        long before = allocations;
+        double start = now_seconds();
+        if (!parse(&ast)) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        double seconds = now_seconds() - start;
+        if (seconds < best) {
+            best = seconds;
+        }
+        if (round == 0) {
+            first_allocations = allocations - before;
+        } else {
+            later_allocations += allocations - before;
+        }
+    }
+    unsigned long long h = hash_tree(&ast);
+    size_t nodes = ast.count;
+
+    double start = now_seconds();
+    ast_free(&ast);
+    double free_seconds = now_seconds() - start;
+
+    printf("  parse %10.3f ms  free %8.3f ms  %zu nodes\n", best * 1e3, free_seconds * 1e3, nodes);
+    printf("  allocations: %ld in the first parse", first_allocations);
+    if (rounds > 1) {
+        printf(", %.1f in each later one", (double)later_allocations / (rounds - 1));
+    }
+    printf("\n  tree %016llx\n", h);
+
+    token_buffer_free(&tokens);
+    source_close(&src);
+    intern_free();
+    return 0;
+}
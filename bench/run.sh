@@ -0,0 +1,192 @@
+#!/bin/sh
+# run.sh - build what a benchmark suite needs and time it
+#
+# Usage, from anywhere: bench/run.sh SUITE [REVISION]
+#   keywords  keyword classification alone (bench/keywords.c)
+#   lexer     --lex-only with the SIMD scanners, -DLEXER_SCALAR and -DLEXER_DFA
+#   alloc     allocations, parse and free times (bench/parse.c)
+#   parser    the recursive and the -DPARSER_STACK parser (bench/parse.c)
+#   semantic  the resolve and semantic phases of the driver
+#   threads   --lex-only sequentially and on 1 to (CPU count) threads, or on
+#             each count in THREADS (e.g. THREADS="1 2 4 8")
+# With a REVISION, the lexer and semantic suites also build the driver of that
+# git revision and time it on the same inputs, e.g. bench/run.sh semantic 259b71d^
+# Times are in ms, the best of RUNS runs (default 5). The inputs come from
+# bench/gen.sh and are the same on every run.
+
+cd "$(dirname "$0")/.." || exit 2
+build=$(mktemp -d) || exit 2
+trap 'rm -rf "$build"' EXIT
+CC=${CC:-gcc}
+RUNS=${RUNS:-5}
+suite=$1
+revision=$2
+
+# build NAME FLAGS...: the driver with extra flags, as $build/NAME
+build() {
+    build_name=$1
+    shift
+    $CC -O2 -pthread "$@" -o "$build/$build_name" src/*/*.c || exit 2
+}
+
+# build_revision: the driver of $revision, as $build/revision
+build_revision() {
+    mkdir "$build/tree" &&
+    git archive "$revision" src include | tar -x -C "$build/tree" &&
+    (cd "$build/tree" && $CC -O2 -pthread -o "$build/revision" src/*/*.c) || exit 2
+}
+
+# build_parse NAME FLAGS...: bench/parse.c with extra flags, as $build/NAME
+build_parse() {
+    build_name=$1
+    shift
+    $CC -O2 -pthread "$@" -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc -o "$build/$build_name" \
+        bench/parse.c src/lexer/*.c src/parser/*.c src/source/*.c src/intern/*.c || exit 2
+}
+
+# input NAME [N]: path of the generated input, made on first use
+input() {
+    input_file="$build/$1${2:+-$2}.txt"
+    [ -f "$input_file" ] || bench/gen.sh "$1" $2 > "$input_file"
+    echo "$input_file"
+}
+
+# phases BINARY "PHASE..." FILE OPTIONS...: best time of each phase the driver
+# reports, "-" for one it does not report, "crash" if it does not finish
+phases() {
+    phase_binary=$1
+    phase_names=$2
+    phase_file=$3
+    shift 3
+    i=0
+    : > "$build/times"
+    while [ $i -lt "$RUNS" ]; do
+        if ! "$phase_binary" "$@" "$phase_file" > /dev/null 2> "$build/err" &&
+           ! grep -q "AST nodes\|lexical errors" "$build/err"; then
+            echo "$phase_names" | sed 's/[^ ]*/crash/g'
+            return
+        fi
+        cat "$build/err" >> "$build/times"
+        i=$((i + 1))
+    done
+    awk -v names="$phase_names" '
+        { if (!($1 in best) || $2 < best[$1]) best[$1] = $2 + 0 }
+        END {
+            k = split(names, name, " ")
+            for (j = 1; j <= k; j++) printf "%s%s", (name[j] in best) ? sprintf("%.3f", best[name[j]]) : "-", j < k ? " " : "\n"
+        }' "$build/times"
+}
+
+case "$suite" in
+keywords)
+    $CC -O2 -o "$build/keywords" bench/keywords.c src/lexer/scan.c src/lexer/utf8.c src/source/lines.c || exit 2
+    echo "keyword classification, best of 7 passes over 4M words:"
+    "$build/keywords"
+    ;;
+
+lexer)
+    build default
+    build scalar -DLEXER_SCALAR
+    build dfa -DLEXER_DFA
+    binaries="default scalar dfa"
+    if [ -n "$revision" ]; then
+        build_revision
+        binaries="$binaries revision"
+    fi
+    echo "lex phase (--lex-only), ms; scalar is -DLEXER_SCALAR, dfa is -DLEXER_DFA"
+    printf "  %-20s" input
+    for b in $binaries; do printf " %10s" "$b"; done
+    echo
+    for name in dense comments identifiers; do
+        file=$(input $name)
+        printf "  %-20s" "$name, $(($(wc -c < "$file") / 1000000)) MB"
+        for b in $binaries; do printf " %10s" "$(phases "$build/$b" lex "$file" --lex-only)"; done
+        echo
+    done
+    ;;
+
+alloc)
+    build_parse parse
+    for n in 3000 300000; do
+        file=$(input prog $n)
+        echo "prog $n, $(($(wc -c < "$file") / 1000)) KB:"
+        "$build/parse" "$file" "$RUNS" | grep -v "^  tree"
+    done
+    ;;
+
+parser)
+    build_parse recursive
+    build_parse stack -DPARSER_STACK
+    echo "parse only, ms, 8 MB stack unless noted; stack is -DPARSER_STACK"
+    printf "  %-30s %10s %10s\n" input recursive stack
+    for case in "brace 1000000" "if 1000000" "mixed 1000000" "mixed 100000 unlimited" "few" "prog 300000"; do
+        set -- $case
+        file=$(input $1 $2)
+        stack=${3:-8192}
+        line="  $(printf "%-30s" "$1 ${2:+$2 }${3:+($3 stack)}")"
+        for b in recursive stack; do
+            if sh -c 'ulimit -s "$1" 2> /dev/null; exec "$2" "$3" "$4"' sh "$stack" "$build/$b" "$file" "$RUNS" \
+                   > "$build/$b.out" 2> /dev/null; then
+                line="$line $(awk '$1 == "parse" { printf "%10s", $2 }' "$build/$b.out")"
+            else
+                line="$line $(printf "%10s" crash)"
+                echo crash > "$build/$b.out"
+            fi
+        done
+        if ! grep -q crash "$build/recursive.out" "$build/stack.out" &&
+           [ "$(grep tree "$build/recursive.out")" != "$(grep tree "$build/stack.out")" ]; then
+            line="$line  (the trees differ)"
+        fi
+        echo "$line"
+    done
+    ;;
+
+semantic)
+    build default
+    binaries=default
+    if [ -n "$revision" ]; then
+        build_revision
+        binaries="revision default"
+    fi
+    echo "driver phases, ms; - if a build does not have the phase"
+    printf "  %-36s" input
+    for b in $binaries; do printf " %10s %10s" "resolve" "semantic"; done
+    echo
+    for case in "flat 100000" "deep 20000" "wide 100000" "outline"; do
+        set -- $case
+        file=$(input $1 $2)
+        printf "  %-36s" "$1 ${2:+$2 }($(($(wc -c < "$file") / 1000)) KB)"
+        for b in $binaries; do
+            printf " %10s %10s" $(phases "$build/$b" "resolve semantic" "$file")
+        done
+        echo
+    done
+    [ -z "$revision" ] || echo "  (left: $revision, right: the working tree)"
+    ;;
+
+threads)
+    build default
+    cpus=$(getconf _NPROCESSORS_ONLN 2> /dev/null || echo 1)
+    echo "lex phase (--lex-only), ms, on $cpus CPU(s)"
+    counts=$THREADS
+    n=1
+    while [ -z "$THREADS" ] && [ $n -le "$cpus" ]; do
+        counts="$counts $n"
+        n=$((n * 2))
+    done
+    printf "  %-20s %10s" input sequential
+    for n in $counts; do printf " %10s" "$n thr"; done
+    echo
+    for name in dense identifiers; do
+        file=$(input $name)
+        printf "  %-20s %10s" "$name" "$(phases "$build/default" lex "$file" --lex-only)"
+        for n in $counts; do printf " %10s" "$(phases "$build/default" lex "$file" --lex-only --threads=$n)"; done
+        echo
+    done
+    ;;
+
+*)
+    echo "usage: $0 keywords|lexer|alloc|parser|semantic|threads [revision]" >&2
+    exit 2
+    ;;
+esac
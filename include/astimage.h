@@ -0,0 +1,55 @@
+/* astimage.h */
+#ifndef ASTIMAGE_H
+#define ASTIMAGE_H
+
+#include <stdint.h>
+#include "lexer.h"
+#include "parser.h"
+
+/* Binary AST images
+ * An image is a file holding the AST of one source file, with the tokens its
+ * nodes refer to and the names of its identifiers, so that an unchanged
+ * source can skip the lexer and the parser. It starts with a header giving
+ * the format version, the hash and size of the source it was made from, and
+ * the offset and length of each section:
+ *
+ *   nodes       kind, child, sibling, token, name (the arrays of AST)
+ *   tokens      type, error, offset, length (the arrays of TokenBuffer)
+ *   names       start of each name in the characters, then one more
+ *   characters  the names, each followed by a '\0'
+ *
+ * Every section is 8-byte aligned and the nodes name each other by NodeId, so
+ * the file is mapped and the AST's arrays point straight into it; loading does
+ * not touch the nodes. Name ids are only meaningful in the process that made
+ * them, so the names are interned again on loading, in id order, into an
+ * empty pool, which gives each one its old id. Token offsets point into the
+ * source, which the hash guarantees is the same text.
+ *
+ * The nodes of a loaded image are read-only, so it must not hold LazyBlocks
+ * (see ast_image_save), and they are not checked: an image is trusted like
+ * the other outputs of a build. Images are written in the byte order of the
+ * machine; one with another byte order or another version is not loaded.
+ */
+
+typedef struct {
+    AST ast;                // nodes in the mapped file
+    TokenBuffer tokens;     // tokens in the mapped file, pointing into the source
+    void* map;
+    size_t map_size;
+} AstImage;
+
+// Hash of a source text, which names its image
+uint64_t ast_image_key(const char* source, size_t size);
+
+// Write the AST of the source with the given key to path; 0 if it has a
+// LazyBlock or the file cannot be written
+int ast_image_save(const char* path, const AST* ast, uint64_t key, size_t source_size);
+
+// Map the image at path for source, whose key is given. Returns 0 if there is
+// none, it is not for this source, or the name pool is not empty
+int ast_image_load(AstImage* image, const char* path, uint64_t key, const char* source, size_t size);
+
+// Unmap an image loaded by ast_image_load
+void ast_image_close(AstImage* image);
+
+#endif /* ASTIMAGE_H */
@@ -0,0 +1,52 @@
+/* emit.h */
+#ifndef EMIT_H
+#define EMIT_H
+
+#include <stddef.h>
+#include "parser.h"
+
+/* AST emitters
+ * An emitter writes a tree in some format: an indented outline (emit_text,
+ * what print_ast prints), JSON (emit_json) or a Graphviz graph (emit_dot).
+ * ast_emit walks the tree and hands every node to the emitter, which appends
+ * its text to an Output. An Output collects the text in a growable buffer and
+ * writes it to its file descriptor in large blocks, so a dump costs a few
+ * write calls rather than a stdio call per node. Another format only needs
+ * another Emitter.
+ */
+
+typedef struct {
+    int fd;
+    char* data;
+    size_t length;
+    size_t cap;
+    int level;          // indentation of the root, for emit_text
+    int comma;          // a value has been written at this level, for emit_json
+    int failed;         // out of memory or a write failed
+} Output;
+
+void output_init(Output* out, int fd);
+void output_write(Output* out, const char* text, size_t length);
+void output_string(Output* out, const char* text);
+void output_char(Output* out, char c);
+void output_spaces(Output* out, size_t count);
+void output_number(Output* out, unsigned long number);
+int output_flush(Output* out);          // 0 if a write failed
+void output_free(Output* out);          // flush and release the buffer
+
+typedef struct {
+    int walk_flags;                     // for ast_walk_init
+    void (*begin)(Output* out);
+    void (*enter)(Output* out, const AST* ast, const AstVisit* visit);
+    void (*leave)(Output* out, const AST* ast, const AstVisit* visit);
+    void (*end)(Output* out);
+} Emitter;
+
+extern const Emitter emit_text;
+extern const Emitter emit_json;
+extern const Emitter emit_dot;
+
+// Emit the tree under root; 0 if out of memory or a write failed
+int ast_emit(AST* ast, NodeId root, const Emitter* emitter, Output* out);
+
+#endif /* EMIT_H */
@@ -0,0 +1,37 @@
+/* intern.h */
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+/* Identifier intern pool
+ * Every distinct identifier spelling is stored once and given a small integer
+ * id (0, 1, 2, ...). Two identifiers are the same name exactly when their ids
+ * are equal, so later phases compare ids instead of calling strcmp.
+ *
+ * There is one pool per process and it has no locks: only one thread may use
+ * it, the one that interned the first name (the parser's, in the driver; the
+ * lexer threads of --pipeline and --threads do not intern). intern asserts
+ * this. After intern_free the next thread to intern owns the pool.
+ */
+
+// Intern length bytes of name (need not be NUL-terminated)
+// Returns the id of the name, -1 if out of memory
+int intern(const char* name, size_t length);
+
+// Intern a NUL-terminated string
+int intern_cstr(const char* name);
+
+// NUL-terminated spelling of an interned name
+const char* intern_name(int id);
+
+// Length of an interned name in bytes
+size_t intern_length(int id);
+
+// Number of names interned so far
+int intern_count(void);
+
+// Release the pool; all ids become invalid
+void intern_free(void);
+
+#endif /* INTERN_H */
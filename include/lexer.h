@@ -2,11 +2,121 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include <stddef.h>
 #include "tokens.h"
+#include "lines.h"
+
+/* Lexer state
+ * Everything the lexer keeps between two tokens lives here rather than in
+ * globals, so each source gets its own lexer and any number of them can run
+ * at the same time (one per thread, for instance).
+ */
+typedef struct {
+    const char* input;  // '\0'-terminated source text
+    int pos;            // offset of the next unread byte
+    int errors;         // number of error tokens returned so far
+    ErrorType error;    // error of the most recent error token, ERROR_NONE if none
+} Lexer;
+
+// Start lexing input from its first byte
+void lexer_init(Lexer* lexer, const char* input);
+
+// Next token of the input; returns TOKEN_EOF (repeatedly) at the end
+Token lexer_next_token(Lexer* lexer);
+
+/* Token buffer
+ * All tokens of a source, lexed up front and stored field by field in
+ * parallel arrays (token i is type[i], offset[i], ...). Readers index it
+ * directly, so any amount of lookahead is free, and tools that need the
+ * tokens again reuse the buffer instead of lexing a second time.
+ */
+typedef struct {
+    const char* source;     // text the offsets point into
+    uint16_t* type;         // TokenType
+    uint16_t* error;        // ErrorType
+    uint32_t* offset;
+    uint32_t* length;
+    size_t count;           // number of tokens, the last one is TOKEN_EOF
+    size_t cap;
+    int errors;             // number of tokens with an error
+} TokenBuffer;
+
+// Empty buffer for tokens of source
+void token_buffer_init(TokenBuffer* buffer, const char* source);
+
+// Lex all of source (size bytes, '\0'-terminated) into buffer
+// Returns 0 if out of memory; free the buffer either way
+int token_buffer_lex(TokenBuffer* buffer, const char* source, size_t size);
+
+// Same, on up to threads threads; produces exactly the same tokens. Not faster
+// than token_buffer_lex on the machines measured so far (see bench/run.sh threads)
+int lex_parallel(TokenBuffer* buffer, const char* source, size_t size, int threads);
+
+/* Pipelined lexer
+ * Lexes on a thread of its own, running ahead of the reader by up to a few
+ * thousand tokens, so lexing overlaps with whatever consumes the tokens. The
+ * tokens are handed over through a lock-free ring; the lexer waits while the
+ * ring is full and the reader while it is empty.
+ */
+typedef struct TokenPipe TokenPipe;
+
+// Start lexing source ('\0'-terminated) on a new thread
+// Returns NULL if the thread could not be started or out of memory
+TokenPipe* token_pipe_open(const char* source);
+
+// Token k places after the current one (k small: the lexer is at most a ring
+// ahead); past the end this is the final TOKEN_EOF
+Token token_pipe_peek(TokenPipe* pipe, size_t k);
+
+// Move to the next token
+void token_pipe_advance(TokenPipe* pipe);
+
+// Stop the lexer thread, wherever it is, and free the pipe
+// Returns the number of error tokens it lexed
+int token_pipe_close(TokenPipe* pipe);
+
+// Grow the arrays to hold at least count tokens, returns 0 if out of memory
+int token_buffer_reserve(TokenBuffer* buffer, size_t count);
+
+// Add count tokens at the end, returns 0 if out of memory
+int token_buffer_append(TokenBuffer* buffer, const Token* tokens, size_t count);
+
+// Token i; past the end this is the final TOKEN_EOF
+Token token_buffer_get(const TokenBuffer* buffer, size_t i);
+
+void token_buffer_free(TokenBuffer* buffer);
 
 // Lexer functions that need to be visible to other files
-Token get_next_token(const char* input, int* pos);
-void print_token(Token token);
-void print_error(ErrorType error, int line, const char* lexeme);
+void print_token(const Token* token, const char* source, SourceLocation where);
+void print_error(ErrorType error, SourceLocation where, const char* lexeme, int length);
+
+/* Streaming lexer
+ * Lexes input pulled in fixed-size chunks from a file descriptor or a read
+ * callback, so the program never has to be in memory as a whole. Produces the
+ * same tokens as lexer_next_token would on the complete input.
+ */
+typedef struct StreamLexer StreamLexer;
+
+// Read callback: fill up to cap bytes of buf
+// Returns the number of bytes read, 0 at end of input, -1 on error
+typedef long (*LexerReadFn)(void* ctx, char* buf, size_t cap);
+
+StreamLexer* stream_lexer_open(LexerReadFn read_fn, void* ctx);
+StreamLexer* stream_lexer_open_fd(int fd);
+void stream_lexer_close(StreamLexer* lx);
+Token stream_next_token(StreamLexer* lx);
+
+// Text of a token returned by stream_next_token, valid until the next call
+// Returns the number of bytes available at *text: token->length, or 0 for a
+// token longer than the window (its text is no longer held anywhere)
+size_t stream_token_text(const StreamLexer* lx, const Token* token, const char** text);
+
+// Line and column of a token just returned by stream_next_token
+SourceLocation stream_token_location(StreamLexer* lx, const Token* token);
+
+// Number of input bytes consumed so far
+unsigned long long stream_lexer_offset(const StreamLexer* lx);
+// Non-zero if reading the input failed
+int stream_lexer_error(const StreamLexer* lx);
 
 #endif /* LEXER_H */
\ No newline at end of file
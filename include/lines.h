@@ -0,0 +1,43 @@
+/* lines.h */
+#ifndef LINES_H
+#define LINES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Line and column of a byte offset
+ * Tokens only record the offset they start at; lines and columns are worked
+ * out from it when a message needs them. The first lookup scans the text for
+ * newlines once and records the offset every line starts at, later lookups
+ * are a binary search in that table. Every '\n' starts a new line, also inside
+ * strings and comments. Columns count bytes from 1.
+ */
+typedef struct {
+    int line;
+    int column;
+} SourceLocation;
+
+typedef struct {
+    const char* text;
+    size_t size;
+    uint32_t* starts;   // offset of the first byte of each line, NULL until built
+    size_t count;       // number of lines
+} LineIndex;
+
+// Index for text[0, size); nothing is scanned until the first lookup
+void line_index_init(LineIndex* index, const char* text, size_t size);
+
+// Line and column of text[offset]
+SourceLocation line_index_locate(LineIndex* index, size_t offset);
+
+// Offset of a line and column, (size_t)-1 if the text has no such place
+// (a column may point at the line's '\n' or the end of the text)
+size_t line_index_offset(LineIndex* index, SourceLocation where);
+
+void line_index_free(LineIndex* index);
+
+// Number of '\n' in text[0, size); if there are any, *line_start is set to
+// the offset just past the last one
+size_t count_newlines(const char* text, size_t size, size_t* line_start);
+
+#endif /* LINES_H */
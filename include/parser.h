@@ -3,6 +3,7 @@
 #define PARSER_H
 
 #include "tokens.h"
+#include "lexer.h"
 
 // Basic node types for AST
 typedef enum {
@@ -25,6 +26,9 @@ typedef enum {
     // Added by Lucy
     AST_COMP,
     AST_OPERATOR,
+    AST_ERROR,          // a statement with a syntax error
+    AST_LAZY_BLOCK,     // a block whose body has not been parsed yet
+    AST_REF,            // a repeated expression, stored once (see parser_set_share)
 } ASTNodeType;
 
 typedef enum {
@@ -47,20 +51,129 @@ typedef enum {
     PARSE_ERROR_FUNCTION_UNDEFINED
 } ParseError;
 
-// AST Node structure
-typedef struct ASTNode {
-    ASTNodeType type;           // Type of node
-    Token token;               // Token associated with this node
-    struct ASTNode* left;      // Left child
-    struct ASTNode* right;     // Right child
-    // TODO: Add more fields if needed
-    struct ASTNode* args;
-} ASTNode;
+/* Abstract syntax tree
+ * Nodes are stored in parallel arrays and named by their index, a NodeId.
+ * Instead of a copy of its token a node keeps the token's index in the token
+ * stream, and instead of child pointers its first child and its next sibling:
+ *
+ *   Program             the statements
+ *   VarDecl             -                       (token: the variable)
+ *   Assign              Identifier, expression  (token: the variable)
+ *   Print               expression
+ *   If, While           condition, body         (no condition: just the body)
+ *   Repeat              body, condition
+ *   Block               the statements
+ *   FunctionCall        the argument
+ *   BinaryOp            left, right             (token: the operator)
+ *   Comparison          left, right             (token: the operator)
+ *   Operator            operand                 (prefix + or -)
+ *   Error               -                       (token: the statement's)
+ *   LazyBlock           -                       (child: index of its '}' token)
+ *   Ref                 -                       (child: the expression it repeats)
+ *
+ * An expression the parser did not find is simply left out. A statement with a
+ * syntax error is replaced by an Error node; the parser reports the error,
+ * counts it in errors and carries on with the next statement. In lazy mode
+ * (parser_set_lazy) blocks are LazyBlocks until ast_expand makes them Blocks;
+ * code that walks into a block must expand it first. With sharing on
+ * (parser_set_share) an expression that occurs more than once is stored once
+ * and the other occurrences are Refs to it. A Ref's child is the shared node,
+ * not the start of a child list; code that walks into an expression must
+ * follow it. The root is node
+ * 0 (AST_ROOT), which is nobody's child or sibling, so 0 also serves as "no
+ * node" (AST_NONE) in the child and sibling arrays.
+ */
+typedef uint32_t NodeId;
+
+#define AST_ROOT 0
+#define AST_NONE 0
+
+typedef struct {
+    uint8_t* kind;              // ASTNodeType
+    NodeId* child;              // first child, AST_NONE if it has none
+    NodeId* sibling;            // next sibling, AST_NONE for the last child
+    uint32_t* token;            // index of the node's token in tokens
+    int* name;                  // interned identifier id, -1 if the token is not an identifier
+    size_t count;               // number of nodes
+    size_t cap;
+    int errors;                 // syntax errors found by the parse
+    int sharing;                // parsed with sharing on (see parser_set_share)
+    NodeId* shared;             // hash table of its shared expressions, AST_NONE if empty,
+    size_t shared_cap;          //   which ast_expand goes on filling
+    size_t shared_count;
+    const TokenBuffer* tokens;  // the tokens the nodes refer to
+} AST;
+
+void ast_init(AST* ast);
+void ast_reset(AST* ast);                            // drop the nodes, keep the arrays for the next parse
+void ast_free(AST* ast);
+Token ast_token(const AST* ast, NodeId node);        // the token of a node
+
+// Index of the token that token, of a node under a shared expression whose
+// own token is shared, is in the occurrence a Ref with token here stands for.
+// It is found by where it sits among the tokens of the expression, not
+// counting parentheses; here if it is not there. token itself if shared is
+// here (outside Refs)
+uint32_t ast_token_here(const AST* ast, uint32_t shared, uint32_t here, uint32_t token);
+int ast_is_condition(const AST* ast, NodeId parent, NodeId node);  // node is the condition of an if, while or repeat
+int ast_expand(AST* ast, NodeId block);              // parse a LazyBlock's body; 0 if out of memory
+NodeId ast_copy(AST* ast, NodeId node);              // unshared copy of an expression; AST_NONE if it cannot be made
+
+/* Walking the tree
+ * ast_walk_next visits every node of the subtree under root twice: on the way
+ * down (AST_ENTER, before its children) and on the way back up (AST_LEAVE,
+ * after them). The path from root is kept on a stack on the heap, so the depth
+ * of the tree is only limited by memory. The children of a node are looked up
+ * after its AST_ENTER, so a LazyBlock expanded then is walked into; one that
+ * is not is a leaf. A Ref is a leaf too, unless the walk was started with
+ * AST_WALK_REFS, in which case the expression it repeats is visited in its
+ * place.
+ */
+typedef enum {
+    AST_ENTER,
+    AST_LEAVE,
+} AstEvent;
+
+#define AST_WALK_REFS 1
+
+typedef struct {
+    NodeId node;
+    NodeId parent;              // AST_NONE for root
+    size_t depth;               // 0 for root
+    AstEvent event;
+} AstVisit;
+
+typedef struct {
+    NodeId node;
+    NodeId next;                // child to visit next
+    int started;                // next has been looked up
+} AstFrame;
+
+typedef struct {
+    const AST* ast;
+    NodeId root;
+    int flags;
+    int begun;                  // root has been entered
+    int out_of_memory;          // the walk stopped early
+    AstFrame* stack;
+    size_t count;
+    size_t cap;
+} AstWalk;
+
+void ast_walk_init(AstWalk* walk, const AST* ast, NodeId root, int flags);
+int ast_walk_next(AstWalk* walk, AstVisit* visit);   // 0 when every node has been left
+void ast_walk_skip(AstWalk* walk);                   // after AST_ENTER: leave the node without visiting its children
+void ast_walk_free(AstWalk* walk);
 
 // Parser functions
-void parser_init(const char* input);
-ASTNode* parse(void);
-void print_ast(ASTNode* node, int level);
-void free_ast(ASTNode* node);
+int parser_init(const char* input);                  // lexes input itself; 0 if out of memory
+void parser_init_tokens(const TokenBuffer* tokens);  // parses tokens lexed beforehand
+int parser_init_pipe(TokenPipe* pipe, const char* source, size_t size);  // parses tokens while they are lexed; 0 if out of memory
+void parser_set_lazy(int on);                        // leave block bodies to ast_expand
+void parser_set_share(int on);                       // store repeated expressions once
+int parse(AST* ast);                                 // replaces the nodes of ast; 0 if out of memory
+const char* parser_source(void);                     // text the tokens point into
+SourceLocation parser_locate(const Token* token);    // line and column of a token
+void print_ast(AST* ast, NodeId node, int level);
 
 #endif /* PARSER_H */
\ No newline at end of file
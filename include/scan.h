@@ -0,0 +1,45 @@
+/* scan.h */
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/* Byte-run scanners used by the lexer's hot loops
+ * Each scanner starts at p and returns a pointer to the first byte that does
+ * not belong to the run. The input must be '\0'-terminated; '\0' never belongs
+ * to a run, so every scan stops at the terminator at the latest.
+ *
+ * SSE2 and AVX2 versions examine 16/32 bytes per step and are chosen at run
+ * time from the CPU's features; a portable scalar version is the fallback.
+ * The scanners are function pointers bound to the chosen set; call them like
+ * functions.
+ */
+
+// Spaces, tabs and newlines
+extern const char* (*scan_whitespace)(const char* p);
+
+// Body of a // comment: stops at the '\n' ending it (or the terminator)
+extern const char* (*scan_line_comment)(const char* p);
+
+// Body of a /* comment: stops at the "*/" closing it (or the terminator)
+extern const char* (*scan_block_comment)(const char* p);
+
+// Rest of an identifier: letters, digits and '_'
+extern const char* (*scan_word)(const char* p);
+
+// Decimal digits
+extern const char* (*scan_digits)(const char* p);
+
+// Non-zero if p[0, n) is well-formed UTF-8. Unlike the scanners above this
+// reads exactly n bytes, which may include '\0'. Blocks without a byte >= 0x80
+// take a fast path, so ASCII text costs little more than a load per block.
+extern int (*scan_utf8_valid)(const char* p, size_t n);
+
+// Force a kernel set: "scalar", "sse2" or "avx2"
+// Returns 0 if that set is not available on this CPU or build
+int scan_select(const char* name);
+
+// Name of the kernel set in use
+const char* scan_kernel_name(void);
+
+#endif /* SCAN_H */
@@ -1,3 +1,7 @@
+/* semantic.h */
+#ifndef SEMANTIC_H
+#define SEMANTIC_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,33 +13,59 @@
 
 // Basic symbol structure
 typedef struct Symbol {
-    char name[100];          // Variable name
+    int name;                // Variable name (interned identifier id)
     int type;                // Data type (int, etc.)
     int scope_level;         // Scope nesting level
-    int line_declared;       // Line where declared
+    uint32_t declared_at;    // Source offset of the declaration
     int is_initialized;      // Has been assigned a value?
-    struct Symbol* next;     // For linked list implementation
+    int shadowed;            // Symbol of the same name this one hides, or -1
+    int id;                  // Dense id given by resolve_names, -1 otherwise
 } Symbol;
 
-// Symbol table
+// Slot of the name table: a name and its innermost symbol
+typedef struct {
+    int name;                // -1: empty
+    int symbol;              // Index into symbols, -1 if the name is not declared now
+} SymbolSlot;
+
+/* Symbol table
+ * The symbols in scope are kept on a stack in the order they were declared,
+ * which doubles as the undo log of the scopes: marks records the height of
+ * the stack when each scope was entered, and leaving a scope takes back what
+ * was declared since, putting back the symbols it shadowed. An
+ * open-addressing hash table keyed by name gives the innermost symbol of
+ * each name, so declaring, looking up and leaving a scope cost O(1) per
+ * symbol involved, however many symbols there are.
+ */
 typedef struct {
-    Symbol* head;            // First symbol in the table
+    Symbol* symbols;         // Stack of the symbols in scope, innermost last
+    int count;
+    int cap;
+    SymbolSlot* slots;       // Name table, a power of two in size
+    int slot_count;          // Slots in use
+    int slot_cap;
+    int* marks;              // Height of the stack when each scope level was entered
+    int mark_cap;
     int current_scope;       // Current scope level
+    unsigned long generation; // Changes whenever a lookup could give a different answer
 } SymbolTable;
 
-
 // Initialize a new symbol table
 // Creates an empty symbol table structure with scope level set to 0
 SymbolTable* init_symbol_table();
 
 // Add a symbol to the table
-// Inserts a new variable with given name, type, and line number into the current scope
-void add_symbol(SymbolTable* table, const char* name, int type, int line);
+// Inserts a new variable with given name, type, and source offset into the current scope
+// Returns the new symbol, NULL if out of memory
+Symbol* add_symbol(SymbolTable* table, int name, int type, uint32_t offset);
 
 // Look up a symbol in the table
 // Searches for a variable by name across all accessible scopes
-// Returns the symbol if found, NULL otherwise
-Symbol* lookup_symbol(SymbolTable* table, const char* name);
+// Returns the symbol if found, NULL otherwise; it stays valid until the next add_symbol
+Symbol* lookup_symbol(SymbolTable* table, int name);
+
+// Look up a symbol declared in the current scope only
+Symbol* lookup_symbol_current_scope(SymbolTable* table, int name);
 
 // Enter a new scope level
 // Increments the current scope level when entering a block (e.g., if, while)
@@ -69,14 +99,62 @@ typedef enum {
     SEM_ERROR_SEMANTIC_ERROR
 } SemanticErrorType;
 
-// Report semantic errors
-void semantic_error(SemanticErrorType error, const char* name, int line);
+// Report semantic errors at the line and column of token
+void semantic_error(SemanticErrorType error, const char* name, const Token* token);
+
+/* Name resolution
+ * resolve_names walks the tree once with a symbol table and binds every
+ * name to its declaration: each declaration gets a dense symbol id, and
+ * symbol[] records it on the VarDecl, on an Assign and its Identifier, and on
+ * every Identifier in an expression. What is known about a symbol is kept in
+ * flat arrays indexed by its id, so the checks after it (and an interpreter or
+ * a code generator) never look a name up. Storage slots are reused by
+ * symbols whose scopes do not overlap; slots is the number a frame needs.
+ *
+ * A shared expression (see parser_set_share) is one set of nodes for all its
+ * occurrences, so it can only be bound one way. An occurrence where its names
+ * mean other symbols gets a copy of its own under its Ref (see ast_copy).
+ * Lazy blocks are parsed on the way.
+ */
+
+#define SYMBOL_NONE (-1)        // not a name, or a name that is not declared there
+#define SYMBOL_REDECLARED (-2)  // a VarDecl of a name already declared in its scope
+#define SYMBOL_UNRESOLVED (-3)  // a node the resolver has not reached
+
+typedef struct {
+    int* symbol;             // By NodeId: the symbol a node names
+    size_t nodes;            // Nodes symbol[] covers
+    int* name;               // By symbol id: interned name
+    int* type;               // Data type
+    int* scope_level;        // Scope nesting level of the declaration
+    uint32_t* declared_at;   // Source offset of the declaration
+    int* slot;               // Storage slot
+    int count;               // Symbols
+    int cap;
+    int slots;               // Storage slots needed
+} Resolution;
+
+// Bind the names in the tree; 0 if out of memory
+int resolve_names(AST* ast, Resolution* names);
+
+// Free the arrays of a resolution
+void free_resolution(Resolution* names);
 
 // Special feature validation: validate function calls (e.g. factorial)
-int check_function_call(ASTNode* node, SymbolTable* table);
+int check_function_call(const AST* ast, NodeId node, Resolution* names);
 
 
 // Semantic checking functions for tye checking and variable checking 
-int check_declaration(ASTNode* node, SymbolTable* table);
-int check_assignment(ASTNode* node, SymbolTable* table);
-int check_expression(ASTNode* node, SymbolTable* table);
\ No newline at end of file
+int check_declaration(const AST* ast, NodeId node, Resolution* names);
+int check_assignment(const AST* ast, NodeId node, Resolution* names);
+int check_expression(const AST* ast, NodeId node, Resolution* names);
+
+// Check a resolved tree; can be run again on the same resolution
+// Returns 1 if the program is semantically valid, 0 otherwise
+int analyze_resolved(const AST* ast, Resolution* names);
+
+// Main semantic analysis function: resolve_names, then analyze_resolved
+// Returns 1 if the program is semantically valid, 0 otherwise
+int analyze_semantics(AST* ast);
+
+#endif /* SEMANTIC_H */
@@ -0,0 +1,27 @@
+/* source.h */
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+
+/* A source file loaded for analysis.
+ * Regular files are mapped read-only with mmap, anything else (pipes, stdin)
+ * is read into a heap buffer. Either way data[size] is guaranteed to be '\0',
+ * so the lexer can keep scanning for the terminator even when the file itself
+ * does not end in one.
+ */
+typedef struct {
+    const char* data;   // File contents followed by at least one '\0'
+    size_t size;        // Size of the file in bytes (terminator not counted)
+    size_t map_size;    // Bytes reserved by the mapping, 0 if heap allocated
+} SourceFile;
+
+// Load the file at path ("-" reads standard input)
+// Returns 0 on success, -1 on failure (errno is left set, EFBIG for more than
+// INT_MAX bytes)
+int source_open(SourceFile* src, const char* path);
+
+// Release the mapping or buffer held by src
+void source_close(SourceFile* src);
+
+#endif /* SOURCE_H */
@@ -0,0 +1,41 @@
+/* utf8.h */
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* UTF-8 helpers for the lexer
+ * Source text is UTF-8. Identifiers may contain the characters C11 allows in
+ * identifiers (Annex D: letters of all scripts, CJK ideographs, ... but no
+ * punctuation, symbols or spaces), string literals may contain any well-formed
+ * UTF-8, and comments are skipped without being looked at.
+ */
+
+// Decode the character at p, of which at most avail bytes may be read
+// Returns its length (1-4) and stores the code point in *cp, or returns 0 if
+// p does not start a well-formed sequence (overlong forms, surrogates and
+// code points past U+10FFFF are not well-formed)
+int utf8_decode(const char* p, size_t avail, uint32_t* cp);
+
+// Length of the character at p if it may appear in an identifier (at its
+// start if first is set), 0 if not. Reads no further than a '\0'.
+int utf8_identifier_char(const char* p, int first);
+
+/* Incremental validation, one byte at a time, for text that arrives in
+ * pieces; the vectorized scan_utf8_valid (scan.h) checks a whole buffer.
+ */
+typedef struct {
+    int need;                   // continuation bytes still expected
+    unsigned char lo, hi;       // range of the next one
+} Utf8Stream;
+
+#define UTF8_STREAM_INIT {0, 0x80, 0xBF}
+
+// Add one byte; returns 0 if the text is no longer well-formed
+int utf8_feed(Utf8Stream* s, unsigned char byte);
+
+// Non-zero if the text fed so far ends on a character boundary
+#define UTF8_COMPLETE(s) ((s).need == 0)
+
+#endif /* UTF8_H */
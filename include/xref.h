@@ -0,0 +1,64 @@
+/* xref.h */
+#ifndef XREF_H
+#define XREF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "parser.h"
+#include "semantic.h"
+
+/* Cross-reference index
+ * Where every symbol is declared and used, by source offset, for "go to
+ * definition" and "find all uses" without analyzing the file again. It is
+ * built from a tree and its resolution (see resolve_names) and keeps only
+ * offsets, so it outlives both and can be queried for as long as the source
+ * text is unchanged.
+ *
+ * The uses of all symbols are one array, grouped by symbol and in source
+ * order within a group; use_start[s] is where the group of symbol s starts,
+ * so its uses are found in O(1). Every declaration and use is also a span of
+ * source text in spans, sorted by offset and not overlapping, so the symbol
+ * under an offset is found by binary search in O(log n).
+ *
+ * A name in a shared expression (see parser_set_share) is found at its own
+ * token in each occurrence, by where it sits among the tokens of the
+ * expression, not counting parentheses. If it is not there, the use is
+ * recorded at the Ref's token instead.
+ */
+
+typedef struct {
+    uint32_t start;          // Offset of the first byte
+    uint32_t end;            // Offset just past the last byte
+    int symbol;
+} XrefSpan;
+
+typedef struct {
+    int symbols;             // Symbol ids are 0 to symbols - 1, as in the Resolution
+    uint32_t* declared_at;   // By symbol: offset of the name in its declaration
+    uint32_t* name_length;   // By symbol: length of its name
+    uint32_t* use_start;     // By symbol: first use in uses; symbols + 1 entries
+    uint32_t* uses;          // Offsets of the uses
+    size_t use_count;
+    XrefSpan* spans;         // Declarations and uses, sorted by start
+    size_t span_count;
+} XrefIndex;
+
+// Index the declarations and uses the resolution found; 0 if out of memory
+int xref_build(XrefIndex* index, const AST* ast, const Resolution* names);
+
+void xref_free(XrefIndex* index);
+
+// Symbol whose declaration or use covers offset, SYMBOL_NONE if none does
+int xref_symbol_at(const XrefIndex* index, size_t offset);
+
+// Offset of the declaration of symbol
+uint32_t xref_definition(const XrefIndex* index, int symbol);
+
+// The uses of symbol in source order: *count offsets
+const uint32_t* xref_uses(const XrefIndex* index, int symbol, size_t* count);
+
+// Semantic analysis (see analyze_semantics) that also fills index
+// Returns 1 if the program is semantically valid, 0 otherwise
+int analyze_semantics_xref(AST* ast, XrefIndex* index);
+
+#endif /* XREF_H */
@@ -0,0 +1,518 @@
+/* main.c - command line driver for the analyzer */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../include/source.h"
+#include "../../include/intern.h"
+#include "../../include/lexer.h"
+#include "../../include/scan.h"
+#include "../../include/parser.h"
+#include "../../include/semantic.h"
+#include "../../include/astimage.h"
+#include "../../include/emit.h"
+#include "../../include/lines.h"
+#include "../../include/xref.h"
+
+// Options taken from the command line
+typedef struct {
+    int lex_only;       // Stop after lexing (no parse or semantic phase)
+    int stream;         // Lex through the streaming lexer instead of mapping the file
+    int print_tokens;   // Print every token while lexing
+    const Emitter* print_tree; // Print the AST after parsing in this format, NULL for none
+    const char* tree_file; // Print it to this file instead of stdout
+    int threads;        // Lex on this many threads (0: the plain sequential lexer)
+    int pipeline;       // Lex on a thread of its own while parsing
+    int lazy;           // Parse block bodies only when the analysis gets to them
+    int share;          // Store repeated expressions once
+    const char* cache_dir; // Directory of AST images, NULL for none
+    int xref;           // Build the cross-reference index after the analysis
+    SourceLocation xref_at; // Report the symbol at this place, line 0 for none
+} Options;
+
+// AST of the file being analyzed; its arrays are kept from one file to the
+// next, so only the largest file's AST ever goes through malloc
+static AST tree;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Print one phase timing with its throughput over the source size
+static void report_phase(const char* phase, double seconds, size_t bytes) {
+    double mb_per_sec = seconds > 0 ? (double)bytes / seconds / 1e6 : 0.0;
+    fprintf(stderr, "  %-10s %10.3f ms  %10.1f MB/s\n", phase, seconds * 1e3, mb_per_sec);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options] file...\n"
+            "  -             read the program from standard input\n"
+            "  --lex-only    only run the lexer and report its throughput\n"
+            "  --stream      lex in fixed-size chunks without loading the file (implies --lex-only)\n"
+            "  --tokens      print every token while lexing\n"
+            "  --ast[=FMT]   print the AST after parsing as text (default), json or dot\n"
+            "  --ast-file=F  print the AST to file F instead of standard output\n"
+            "  --threads=N   lex on N threads (experimental, not faster than the default yet)\n"
+            "  --pipeline    lex on a second thread while parsing\n"
+            "  --lazy        parse block bodies only when they are needed (not with --pipeline)\n"
+            "  --share       store each distinct expression once\n"
+            "  --cache=DIR   keep AST images in DIR and load them for unchanged files\n"
+            "  --xref[=L:C]  index declarations and uses; report the variable at line L, column C\n"
+            "  --simd=SET    lexer scan kernels: scalar, sse2 or avx2 (default: best available)\n"
+            "  -h, --help    show this message\n",
+            prog);
+}
+
+// Lex the whole input on opts->threads threads
+static int lex_file_parallel(const SourceFile* src, const Options* opts) {
+    TokenBuffer tokens;
+
+    double start = now_seconds();
+    int ok = lex_parallel(&tokens, src->data, src->size, opts->threads);
+    double lex_time = now_seconds() - start;
+    if (!ok) {
+        fprintf(stderr, "  out of memory\n");
+        token_buffer_free(&tokens);
+        return 0;
+    }
+
+    if (opts->print_tokens) {
+        LineIndex lines;
+        line_index_init(&lines, src->data, src->size);
+        for (size_t i = 0; i < tokens.count; i++) {
+            Token token = token_buffer_get(&tokens, i);
+            print_token(&token, src->data, line_index_locate(&lines, token.offset));
+        }
+        line_index_free(&lines);
+    }
+
+    report_phase("lex", lex_time, src->size);
+    fprintf(stderr, "  %d threads, scan kernels: %s\n", opts->threads, scan_kernel_name());
+    fprintf(stderr, "  %zu tokens, %d lexical errors\n", tokens.count, tokens.errors);
+    ok = tokens.errors == 0;
+    token_buffer_free(&tokens);
+    return ok;
+}
+
+// Lex the whole input without parsing, counting tokens
+static int lex_file(const SourceFile* src, const Options* opts) {
+    if (opts->threads > 0) {
+        return lex_file_parallel(src, opts);
+    }
+
+    Lexer lexer;
+    LineIndex lines;
+    long tokens = 0;
+    Token token;
+
+    lexer_init(&lexer, src->data);
+    line_index_init(&lines, src->data, src->size);
+    double start = now_seconds();
+    do {
+        token = lexer_next_token(&lexer);
+        if (opts->print_tokens) {
+            print_token(&token, src->data, line_index_locate(&lines, token.offset));
+        }
+        tokens++;
+    } while (token.type != TOKEN_EOF);
+    double lex_time = now_seconds() - start;
+    line_index_free(&lines);
+
+    report_phase("lex", lex_time, src->size);
+    fprintf(stderr, "  scan kernels: %s\n", scan_kernel_name());
+    fprintf(stderr, "  %ld tokens, %d lexical errors\n", tokens, lexer.errors);
+    return lexer.errors == 0;
+}
+
+// Lex a file (or stdin) through the streaming lexer, never holding more than
+// one chunk of it in memory
+static int stream_file(const char* path, const Options* opts) {
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    StreamLexer* lx = stream_lexer_open_fd(fd);
+    if (!lx) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        if (fd != STDIN_FILENO) close(fd);
+        return 0;
+    }
+
+    long tokens = 0;
+    long errors = 0;
+    Token token;
+
+    double start = now_seconds();
+    do {
+        token = stream_next_token(lx);
+        if (opts->print_tokens) {
+            // the window only holds the current token, print it from there
+            const char* text;
+            Token shown = token;
+            shown.length = (uint32_t)stream_token_text(lx, &token, &text);
+            shown.offset = 0;
+            print_token(&shown, text, stream_token_location(lx, &token));
+        }
+        if (token.error != ERROR_NONE) errors++;
+        tokens++;
+    } while (token.type != TOKEN_EOF);
+    double lex_time = now_seconds() - start;
+
+    unsigned long long bytes = stream_lexer_offset(lx);
+    int ok = errors == 0;
+    fprintf(stderr, "%s: %llu bytes\n", path, bytes);
+    if (stream_lexer_error(lx)) {
+        fprintf(stderr, "%s: read error\n", path);
+        ok = 0;
+    }
+    report_phase("stream lex", lex_time, (size_t)bytes);
+    fprintf(stderr, "  %ld tokens, %ld lexical errors\n", tokens, errors);
+
+    stream_lexer_close(lx);
+    if (fd != STDIN_FILENO) close(fd);
+    return ok;
+}
+
+// Lex and parse src into tree, printing why if that fails
+static int parse_file(const char* path, const SourceFile* src, const Options* opts,
+                      TokenBuffer* tokens, double* lex_time, double* parse_time) {
+    TokenPipe* pipe = NULL;
+    double start;
+
+    if (opts->pipeline) {
+        // Lexical analysis runs alongside parsing
+        start = now_seconds();
+        pipe = token_pipe_open(src->data);
+        if (!pipe) {
+            fprintf(stderr, "%s: cannot start the lexer thread\n", path);
+            return 0;
+        }
+        if (!parser_init_pipe(pipe, src->data, src->size)) {
+            fprintf(stderr, "%s: out of memory\n", path);
+            token_pipe_close(pipe);
+            return 0;
+        }
+    } else {
+        // Lexical analysis: the whole file up front
+        start = now_seconds();
+        int lexed = opts->threads > 0 ? lex_parallel(tokens, src->data, src->size, opts->threads)
+                                      : token_buffer_lex(tokens, src->data, src->size);
+        *lex_time = now_seconds() - start;
+        if (!lexed) {
+            fprintf(stderr, "%s: out of memory\n", path);
+            return 0;
+        }
+        start = now_seconds();
+        parser_init_tokens(tokens);
+    }
+
+    // Parsing
+    parser_set_lazy(opts->lazy);
+    parser_set_share(opts->share);
+    int parsed = parse(&tree);
+    *parse_time = now_seconds() - start;
+    if (pipe) {
+        token_pipe_close(pipe);
+    }
+    if (!parsed) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+// Print the AST as the options say
+static void print_tree(AST* ast, const Options* opts) {
+    if (opts->print_tree == &emit_text && !opts->tree_file) {
+        printf("\nAbstract Syntax Tree:\n");
+        print_ast(ast, AST_ROOT, 0);
+        return;
+    }
+
+    int fd = STDOUT_FILENO;
+    if (opts->tree_file) {
+        fd = open(opts->tree_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", opts->tree_file, strerror(errno));
+            return;
+        }
+    } else {
+        fflush(stdout); // what was printed before goes first
+    }
+    Output out;
+    output_init(&out, fd);
+    int ok = ast_emit(ast, AST_ROOT, opts->print_tree, &out);
+    output_free(&out);
+    ok = ok && !out.failed;
+    if (fd != STDOUT_FILENO && close(fd) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: cannot print the AST\n", opts->tree_file ? opts->tree_file : "stdout");
+    }
+}
+
+// Name of the image of a source with the given key in the cache directory
+static char* image_path(const char* dir, uint64_t key) {
+    size_t size = strlen(dir) + 32;
+    char* path = malloc(size);
+    if (path) {
+        snprintf(path, size, "%s/%016llx.ast", dir, (unsigned long long)key);
+    }
+    return path;
+}
+
+// Print where the variable at a place in the source is declared and used
+static void print_xref(const XrefIndex* xref, const SourceFile* src, SourceLocation at) {
+    LineIndex lines;
+    line_index_init(&lines, src->data, src->size);
+    size_t offset = line_index_offset(&lines, at);
+    int symbol = offset == (size_t)-1 ? SYMBOL_NONE : xref_symbol_at(xref, offset);
+    if (symbol < 0) {
+        printf("\nNo variable at line %d, column %d\n", at.line, at.column);
+        line_index_free(&lines);
+        return;
+    }
+
+    uint32_t declared_at = xref_definition(xref, symbol);
+    SourceLocation where = line_index_locate(&lines, declared_at);
+    size_t count;
+    const uint32_t* uses = xref_uses(xref, symbol, &count);
+    printf("\nVariable '%.*s' is declared at line %d, column %d and used %zu time%s\n",
+           (int)xref->name_length[symbol], src->data + declared_at, where.line, where.column,
+           count, count == 1 ? "" : "s");
+    for (size_t i = 0; i < count; i++) {
+        where = line_index_locate(&lines, uses[i]);
+        printf("  line %d, column %d\n", where.line, where.column);
+    }
+    line_index_free(&lines);
+}
+
+// Run the full pipeline on one source file, returns 1 if it is valid
+static int analyze_file(const char* path, const Options* opts) {
+    SourceFile src;
+
+    if (opts->stream) {
+        return stream_file(path, opts);
+    }
+
+    double start = now_seconds();
+    if (source_open(&src, path) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    double map_time = now_seconds() - start;
+
+    fprintf(stderr, "%s: %zu bytes\n", path, src.size);
+    report_phase("map", map_time, src.size);
+
+    if (opts->lex_only) {
+        int ok = lex_file(&src, opts);
+        source_close(&src);
+        return ok;
+    }
+
+    printf("Analyzing %s\n\n", path);
+
+    TokenBuffer tokens;
+    double lex_time = 0;
+    double parse_time = 0;
+    token_buffer_init(&tokens, src.data);
+
+    // An unchanged source whose image is in the cache is not lexed or parsed
+    AST* ast = &tree;
+    AstImage image;
+    int cached = 0;
+    uint64_t key = 0;
+    char* cache_path = NULL;
+    double load_time = 0;
+    if (opts->cache_dir) {
+        start = now_seconds();
+        key = ast_image_key(src.data, src.size);
+        cache_path = image_path(opts->cache_dir, key);
+        cached = cache_path && ast_image_load(&image, cache_path, key, src.data, src.size);
+        load_time = now_seconds() - start;
+    }
+
+    if (cached) {
+        ast = &image.ast;
+        parser_init_tokens(ast->tokens);
+    } else if (!parse_file(path, &src, opts, &tokens, &lex_time, &parse_time)) {
+        free(cache_path);
+        token_buffer_free(&tokens);
+        source_close(&src);
+        return 0;
+    }
+
+    if (opts->print_tree) {
+        start = now_seconds();
+        print_tree(ast, opts);
+        report_phase("print", now_seconds() - start, src.size);
+    }
+
+    printf("AST created. Performing semantic analysis...\n\n");
+
+    // Semantic analysis: names are bound first, then the checks use them
+    Resolution names;
+    start = now_seconds();
+    int result = resolve_names(ast, &names);
+    double resolve_time = now_seconds() - start;
+    if (!result) {
+        fprintf(stderr, "Out of memory\n");
+    }
+    start = now_seconds();
+    result = result && analyze_resolved(ast, &names);
+    double semantic_time = now_seconds() - start;
+
+    XrefIndex xref;
+    double xref_time = 0;
+    if (opts->xref) {
+        start = now_seconds();
+        if (!xref_build(&xref, ast, &names)) {
+            fprintf(stderr, "Out of memory\n");
+            result = 0;
+        }
+        xref_time = now_seconds() - start;
+    }
+    free_resolution(&names);
+
+    if (ast->errors > 0) {
+        // counted after the analysis: in lazy mode it is what parses the blocks
+        printf("%d syntax error%s.\n", ast->errors, ast->errors == 1 ? "" : "s");
+    }
+    if (result) {
+        printf("Semantic analysis successful. No errors found.\n");
+    } else {
+        printf("Semantic analysis failed. Errors detected.\n");
+    }
+    if (opts->xref && opts->xref_at.line > 0) {
+        print_xref(&xref, &src, opts->xref_at);
+    }
+
+    if (cached) {
+        report_phase("load", load_time, src.size);
+    } else if (opts->pipeline) {
+        report_phase("lex+parse", parse_time, src.size);
+    } else {
+        report_phase("lex", lex_time, src.size);
+        report_phase("parse", parse_time, src.size);
+    }
+    report_phase("resolve", resolve_time, src.size);
+    report_phase("semantic", semantic_time, src.size);
+    if (opts->xref) {
+        report_phase("xref", xref_time, src.size);
+        fprintf(stderr, "  %zu declarations and uses indexed\n", xref.span_count);
+        xref_free(&xref);
+    }
+    fprintf(stderr, "  %zu AST nodes\n", ast->count);
+
+    // Syntax errors are reported by the parser, so only a clean parse is
+    // worth keeping
+    if (cache_path && !cached && ast->errors == 0 && ast->tokens->errors == 0) {
+        start = now_seconds();
+        if (ast_image_save(cache_path, ast, key, src.size)) {
+            report_phase("save", now_seconds() - start, src.size);
+        } else {
+            fprintf(stderr, "%s: cannot write %s\n", path, cache_path);
+        }
+    }
+
+    // Clean up
+    if (cached) {
+        ast_image_close(&image);
+    } else {
+        ast_reset(&tree);
+    }
+    free(cache_path);
+    token_buffer_free(&tokens);
+    source_close(&src);
+    intern_free();
+    return result;
+}
+
+int main(int argc, char** argv) {
+    Options opts = {0}; // every option off
+    int files = 0;
+    int failed = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--lex-only") == 0) {
+            opts.lex_only = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            opts.stream = 1;
+        } else if (strcmp(argv[i], "--tokens") == 0) {
+            opts.print_tokens = 1;
+        } else if (strcmp(argv[i], "--ast") == 0 || strcmp(argv[i], "--ast=text") == 0) {
+            opts.print_tree = &emit_text;
+        } else if (strcmp(argv[i], "--ast=json") == 0) {
+            opts.print_tree = &emit_json;
+        } else if (strcmp(argv[i], "--ast=dot") == 0) {
+            opts.print_tree = &emit_dot;
+        } else if (strncmp(argv[i], "--ast-file=", 11) == 0) {
+            opts.tree_file = argv[i] + 11;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            opts.pipeline = 1;
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            opts.lazy = 1;
+        } else if (strcmp(argv[i], "--share") == 0) {
+            opts.share = 1;
+        } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+            opts.cache_dir = argv[i] + 8;
+        } else if (strcmp(argv[i], "--xref") == 0) {
+            opts.xref = 1;
+        } else if (strncmp(argv[i], "--xref=", 7) == 0) {
+            opts.xref = 1;
+            if (sscanf(argv[i] + 7, "%d:%d", &opts.xref_at.line, &opts.xref_at.column) != 2 ||
+                opts.xref_at.line < 1 || opts.xref_at.column < 1) {
+                fprintf(stderr, "--xref needs a line and a column, e.g. --xref=12:5\n");
+                return 2;
+            }
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            opts.threads = atoi(argv[i] + 10);
+            if (opts.threads < 1) {
+                fprintf(stderr, "Invalid thread count '%s'\n", argv[i] + 10);
+                return 2;
+            }
+        } else if (strncmp(argv[i], "--simd=", 7) == 0) {
+            if (!scan_select(argv[i] + 7)) {
+                fprintf(stderr, "Scan kernels '%s' are not available\n", argv[i] + 7);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (opts.pipeline && opts.threads > 0) {
+        fprintf(stderr, "--pipeline and --threads cannot be combined\n");
+        return 2;
+    }
+    if (opts.tree_file && !opts.print_tree) {
+        opts.print_tree = &emit_text;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') continue;
+        files++;
+        if (!analyze_file(argv[i], &opts)) failed++;
+    }
+    ast_free(&tree);
+
+    if (files == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    return failed ? 1 : 0;
+}
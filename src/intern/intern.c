@@ -0,0 +1,153 @@
+/* intern.c */
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/intern.h"
+
+#define INITIAL_SLOTS 256   // must be a power of two
+
+// Names are stored back to back in one character buffer, each followed by a
+// '\0' so intern_name can hand out C strings. The hash table maps a name to
+// its id with open addressing (linear probing); empty slots hold -1.
+static char* chars = NULL;
+static size_t chars_used = 0;
+static size_t chars_cap = 0;
+
+static size_t* name_offset = NULL;  // id -> offset into chars
+static size_t* name_length = NULL;  // id -> length of the name
+static unsigned int* name_hash = NULL;
+static int names = 0;
+static int names_cap = 0;
+
+static int* slots = NULL;
+static size_t slot_count = 0;
+
+// The only thread that uses the pool (see intern.h), set by the first intern
+static pthread_t owner;
+static int owned = 0;
+
+// FNV-1a
+static unsigned int hash_name(const char* name, size_t length) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int grow_slots(void) {
+    size_t count = slot_count ? slot_count * 2 : INITIAL_SLOTS;
+    int* table = malloc(count * sizeof(int));
+    if (!table) return 0;
+    for (size_t i = 0; i < count; i++) table[i] = -1;
+
+    // rehash every existing name into the larger table
+    for (int id = 0; id < names; id++) {
+        size_t i = name_hash[id] & (count - 1);
+        while (table[i] != -1) i = (i + 1) & (count - 1);
+        table[i] = id;
+    }
+    free(slots);
+    slots = table;
+    slot_count = count;
+    return 1;
+}
+
+// Append a new name, returns its id or -1
+static int add_name(const char* name, size_t length, unsigned int h) {
+    if (names == names_cap) {
+        int cap = names_cap ? names_cap * 2 : 64;
+        size_t* offsets = realloc(name_offset, cap * sizeof(size_t));
+        if (!offsets) return -1;
+        name_offset = offsets;
+        size_t* lengths = realloc(name_length, cap * sizeof(size_t));
+        if (!lengths) return -1;
+        name_length = lengths;
+        unsigned int* hashes = realloc(name_hash, cap * sizeof(unsigned int));
+        if (!hashes) return -1;
+        name_hash = hashes;
+        names_cap = cap;
+    }
+    if (chars_used + length + 1 > chars_cap) {
+        size_t cap = chars_cap ? chars_cap * 2 : 4096;
+        while (cap < chars_used + length + 1) cap *= 2;
+        char* grown = realloc(chars, cap);
+        if (!grown) return -1;
+        chars = grown;
+        chars_cap = cap;
+    }
+
+    memcpy(chars + chars_used, name, length);
+    chars[chars_used + length] = '\0';
+    name_offset[names] = chars_used;
+    name_length[names] = length;
+    name_hash[names] = h;
+    chars_used += length + 1;
+    return names++;
+}
+
+int intern(const char* name, size_t length) {
+    if (!owned) {
+        owner = pthread_self();
+        owned = 1;
+    }
+    assert(pthread_equal(owner, pthread_self()) && "the intern pool is used by one thread only");
+
+    // keep the table at most half full
+    if ((size_t)(names + 1) * 2 > slot_count && !grow_slots()) {
+        return -1;
+    }
+
+    unsigned int h = hash_name(name, length);
+    size_t i = h & (slot_count - 1);
+    while (slots[i] != -1) {
+        int id = slots[i];
+        if (name_hash[id] == h && name_length[id] == length &&
+            memcmp(chars + name_offset[id], name, length) == 0) {
+            return id;
+        }
+        i = (i + 1) & (slot_count - 1);
+    }
+
+    int id = add_name(name, length, h);
+    if (id >= 0) {
+        slots[i] = id;
+    }
+    return id;
+}
+
+int intern_cstr(const char* name) {
+    return intern(name, strlen(name));
+}
+
+const char* intern_name(int id) {
+    if (id < 0 || id >= names) return "";
+    return chars + name_offset[id];
+}
+
+size_t intern_length(int id) {
+    if (id < 0 || id >= names) return 0;
+    return name_length[id];
+}
+
+int intern_count(void) {
+    return names;
+}
+
+void intern_free(void) {
+    free(chars);
+    free(name_offset);
+    free(name_length);
+    free(name_hash);
+    free(slots);
+    chars = NULL;
+    chars_used = chars_cap = 0;
+    name_offset = name_length = NULL;
+    name_hash = NULL;
+    names = names_cap = 0;
+    slots = NULL;
+    slot_count = 0;
+    owned = 0;
+}
@@ -3,18 +3,18 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
-#include "../../include/tokens.h"
-
-// Line tracking
-static int current_line = 1;
-static char last_token_type = 'x'; // For checking consecutive operators
+#include <errno.h>
+#include <unistd.h>
+#include "../../include/lexer.h"
+#include "../../include/scan.h"
+#include "../../include/utf8.h"
 
 /* Print error messages for lexical errors */
-void print_error(ErrorType error, int line, const char *lexeme) {
-    printf("Lexical Error at line %d: ", line);
+void print_error(ErrorType error, SourceLocation where, const char *lexeme, int length) {
+    printf("Lexical Error at line %d, column %d: ", where.line, where.column);
     switch (error) {
         case ERROR_INVALID_CHAR:
-            printf("Invalid character '%s'\n", lexeme);
+            printf("Invalid character '%.*s'\n", length, lexeme);
             break;
         case ERROR_INVALID_NUMBER:
             printf("Invalid number format\n");
@@ -39,6 +39,10 @@ void print_error(ErrorType error, int line, const char *lexeme) {
             printf("Invalid identifier format\n");
             break;
 
+        case ERROR_INVALID_UTF8:
+            printf("Invalid UTF-8 sequence\n");
+            break;
+
         default:
             printf("Unknown error\n");
     }
@@ -49,14 +53,14 @@ void print_error(ErrorType error, int line, const char *lexeme) {
  *  TODO Update your printing function accordingly
  */
 
-void print_token(Token token) {
-    if (token.error != ERROR_NONE) {
-        print_error(token.error, token.line, token.lexeme);
+void print_token(const Token *token, const char *source, SourceLocation where) {
+    if (token->error != ERROR_NONE) {
+        print_error(token->error, where, TOKEN_TEXT(source, *token), token->length);
         return;
     }
 
     printf("Token: ");
-    switch (token.type) {
+    switch (token->type) {
         case TOKEN_NUMBER:
             printf("NUMBER");
             break;
@@ -74,6 +78,12 @@ void print_token(Token token) {
             printf("ASSIGN");
             break;
         case TOKEN_KEYWORD:
+        case TOKEN_IF:
+        case TOKEN_INT:
+        case TOKEN_PRINT:
+        case TOKEN_WHILE:
+        case TOKEN_REPEAT:
+        case TOKEN_UNTIL:
             printf("KEYWORD");
             break;
         case TOKEN_STRING:
@@ -89,75 +99,388 @@ void print_token(Token token) {
         default:
             printf("UNKNOWN");
     }
-    printf(" | Lexeme: '%s' | Line: %d\n",
-           token.lexeme, token.line);
+    if (token->type == TOKEN_EOF) {
+        printf(" | Lexeme: 'EOF' | Line: %d\n", where.line);
+        return;
+    }
+    printf(" | Lexeme: '%.*s' | Line: %d\n",
+           (int)token->length, TOKEN_TEXT(source, *token), where.line);
 }
 
-/* Get next token from input */
-Token get_next_token(const char *input, int *pos) {
-    Token token = {TOKEN_ERROR, "", current_line, ERROR_NONE};
-    char c;
+/* Keyword recognition
+ * Keywords are found with a perfect hash on (length, first char, last char),
+ * so classifying an identifier costs one table load and two overlapping word
+ * compares. The table is laid out by the compiler from KEYWORDS, and the static
+ * assertion below fails the build if a new keyword collides with another one
+ * (then KEYWORD_HASH or KEYWORD_SLOTS needs changing).
+ */
+#define KEYWORDS(X)                       \
+    X("if",     'i', 'f', TOKEN_IF)       \
+    X("int",    'i', 't', TOKEN_INT)      \
+    X("print",  'p', 't', TOKEN_PRINT)    \
+    X("while",  'w', 'e', TOKEN_WHILE)    \
+    X("repeat", 'r', 't', TOKEN_REPEAT)   \
+    X("until",  'u', 'l', TOKEN_UNTIL)
+
+#define KEYWORD_SLOTS 8
+#define KEYWORD_MIN_LENGTH 2
+#define KEYWORD_MAX_LENGTH 6
+#define KEYWORD_HASH(length, first, last) \
+    (((unsigned)(length) ^ (unsigned char)(first) ^ (unsigned char)(last)) & (KEYWORD_SLOTS - 1))
+
+typedef struct {
+    char word[8];       // zero padded
+    uint32_t length;    // 0 marks an empty slot
+    uint32_t type;
+} Keyword;
+
+#define KEYWORD_ENTRY(word, first, last, type) \
+    [KEYWORD_HASH(sizeof(word) - 1, first, last)] = {word, sizeof(word) - 1, type},
+static const Keyword keyword_table[KEYWORD_SLOTS] = { KEYWORDS(KEYWORD_ENTRY) };
+
+// The hash is perfect iff no two keywords set the same bit
+#define KEYWORD_BIT_OR(word, first, last, type) | (1u << KEYWORD_HASH(sizeof(word) - 1, first, last))
+#define KEYWORD_BIT_SUM(word, first, last, type) + (1u << KEYWORD_HASH(sizeof(word) - 1, first, last))
+_Static_assert((0 KEYWORDS(KEYWORD_BIT_OR)) == (0 KEYWORDS(KEYWORD_BIT_SUM)),
+               "KEYWORD_HASH is not collision free");
+
+static inline uint16_t load16(const char *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
 
-    // Skip whitespace and track line numbers
-    while ((c = input[*pos]) != '\0' && (c == ' ' || c == '\n' || c == '\t')) {
-        if (c == '\n') {
-            current_line++;
-        }
-        (*pos)++;
+static inline uint32_t load32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Token type of an identifier-shaped lexeme: its keyword type or TOKEN_IDENTIFIER
+static TokenType classify_word(const char *lexeme, uint32_t length) {
+    if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH) {
+        return TOKEN_IDENTIFIER;
+    }
+    const Keyword *kw = &keyword_table[KEYWORD_HASH(length, lexeme[0], lexeme[length - 1])];
+
+    // Compare the first and last 4 (or 2) bytes; the two windows overlap and
+    // together cover any length from 2 to 8 without reading past the lexeme
+    int same;
+    if (length >= 4) {
+        same = (load32(lexeme) == load32(kw->word)) &
+               (load32(lexeme + length - 4) == load32(kw->word + length - 4));
+    } else {
+        same = (load16(lexeme) == load16(kw->word)) &
+               (load16(lexeme + length - 2) == load16(kw->word + length - 2));
     }
+    return (same & (kw->length == length)) ? (TokenType)kw->type : TOKEN_IDENTIFIER;
+}
 
-    if (input[*pos] == '\0') {
-        token.type = TOKEN_EOF;
-        strcpy(token.lexeme, "EOF");
-        return token;
+/* Non-ASCII text
+ * Identifiers may use letters of any script (see utf8.h). Both lexers find
+ * their ASCII tokens without looking at bytes >= 0x80 and only come here when
+ * they meet one, so ASCII-only input does not pay for any of this.
+ */
+
+// Rest of an identifier: ASCII word characters and the non-ASCII characters
+// allowed in identifiers
+static const char *scan_identifier(const char *p) {
+    p = scan_word(p);
+    int n;
+    while ((unsigned char)*p >= 0x80 && (n = utf8_identifier_char(p, 0)) > 0) {
+        p = scan_word(p + n);
     }
+    return p;
+}
 
-    c = input[*pos];
+// Token starting with a byte >= 0x80 at pos: an identifier if it is a letter,
+// an invalid character if it is some other character, and otherwise the run of
+// bytes that do not start a UTF-8 character at all
+static Token lex_non_ascii(Lexer *lexer, Token token) {
+    const char *input = lexer->input;
+    const char *p = input + lexer->pos;
+    uint32_t cp;
+    int n;
+
+    if ((n = utf8_identifier_char(p, 1)) > 0) {
+        p = scan_identifier(p + n);
+        token.type = TOKEN_IDENTIFIER;
+    } else if ((n = utf8_decode(p, 4, &cp)) > 0) {
+        p += n;
+        token.error = ERROR_INVALID_CHAR;
+    } else {
+        do {
+            p++;
+        } while ((unsigned char)*p >= 0x80 && !utf8_decode(p, 4, &cp));
+        token.error = ERROR_INVALID_UTF8;
+    }
+    lexer->pos = (int)(p - input);
+    token.length = (uint32_t)lexer->pos - token.offset;
+    return token;
+}
 
-    // TODO: Add comment handling here
-    // Added by Lucy
-    // Handle comments
-    if (c == '/' && input[*pos + 1] == '/') {
-        while (input[*pos] != '\n' && input[*pos] != '\0') {
-            (*pos)++; // skip everything in the comment
-        }
-        return get_next_token(input, pos); // get next token
-    }// Block comment handling by yash 
+// Whether a string token whose body holds bytes >= 0x80 is well-formed
+static Token check_string_utf8(const char *input, Token token) {
+    if (!scan_utf8_valid(input + token.offset + 1, token.length - 2)) {
+        token.type = TOKEN_ERROR;
+        token.error = ERROR_INVALID_UTF8;
+    }
+    return token;
+}
+
+#ifdef LEXER_DFA
+/* Table-driven lexer (build with -DLEXER_DFA)
+ * Replaces the chain of character tests in next_token below with two
+ * tables fixed at compile time: char_class maps each byte to one of a few
+ * classes and transition maps (state, class) to the next state. The loop does
+ * one class lookup and one transition lookup per byte until it reaches a
+ * final state; only then does it branch on what kind of token was found.
+ * Whitespace and comments are states of the same machine. It produces the
+ * same tokens as the hand-written lexer.
+ */
 
-    else if (c == '/' && input [*pos + 1] == '*') { // start of a block comment, edge case noted- ensure only enter block when you have sequence /*.
-        (*pos) += 2; // skip the opening comment
-        int comment_check = 0; // here we can simply make a flag to check if the comment is closed or not
+// Character classes; anything not listed is C_OTHER
+enum {
+    C_OTHER, C_NUL, C_SPACE, C_NEWLINE, C_DIGIT, C_LETTER, C_QUOTE, C_BACKSLASH,
+    C_SLASH, C_STAR, C_PLUS, C_MINUS, C_PERCENT, C_EQUALS, C_DELIM, C_HIGH, C_COUNT
+};
+
+static const unsigned char char_class[256] = {
+    ['\0'] = C_NUL,
+    [' '] = C_SPACE, ['\t'] = C_SPACE, ['\n'] = C_NEWLINE,
+    ['0' ... '9'] = C_DIGIT,
+    ['a' ... 'z'] = C_LETTER, ['A' ... 'Z'] = C_LETTER, ['_'] = C_LETTER,
+    ['"'] = C_QUOTE, ['\\'] = C_BACKSLASH,
+    ['/'] = C_SLASH, ['*'] = C_STAR, ['+'] = C_PLUS, ['-'] = C_MINUS, ['%'] = C_PERCENT,
+    ['='] = C_EQUALS,
+    [';'] = C_DELIM, ['('] = C_DELIM, [')'] = C_DELIM, ['{'] = C_DELIM, ['}'] = C_DELIM,
+    ['<'] = C_DELIM, ['>'] = C_DELIM,
+    [0x80 ... 0xFF] = C_HIGH,
+};
+
+// Token types of the bytes that are a token on their own (class C_DELIM):
+// the delimiters and the comparison operators
+static const unsigned char delim_type[256] = {
+    [';'] = TOKEN_SEMICOLON, ['('] = TOKEN_LPAREN, [')'] = TOKEN_RPAREN,
+    ['{'] = TOKEN_LBRACE, ['}'] = TOKEN_RBRACE,
+    ['<'] = TOKEN_OPERATOR, ['>'] = TOKEN_OPERATOR,
+};
+
+// States below S_COUNT consume the current byte and keep going. Final states
+// stop the machine: F_ states end the token before the current byte, FI_
+// states include it. A string moves to S_STRING_HIGH at its first byte >= 0x80
+// so that only such strings get their UTF-8 checked.
+enum {
+    S_START, S_SLASH, S_LINE_COMMENT, S_BLOCK_COMMENT, S_BLOCK_STAR,
+    S_NUMBER, S_WORD, S_STRING, S_STRING_ESCAPE, S_STRING_HIGH, S_STRING_HIGH_ESCAPE,
+    S_PLUS, S_MINUS, S_STAR, S_PERCENT, S_EQUALS, S_COUNT,
+
+    F_EOF = S_COUNT, F_NUMBER, F_WORD, F_OPERATOR, F_EQUALS,
+    F_UNTERMINATED_STRING, F_UNTERMINATED_COMMENT, F_NON_ASCII,
+    FI_STRING, FI_STRING_HIGH, FI_EQUALS_EQUALS, FI_CONSECUTIVE, FI_DELIM, FI_INVALID
+};
+
+_Static_assert(C_COUNT <= 16, "a transition row holds 16 classes");
+
+#define ALL_CLASSES [0 ... C_COUNT - 1]
+
+// Each row starts from a default for every class and then overrides single
+// classes, which GCC reports under -Woverride-init
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+static const unsigned char transition[S_COUNT][16] = {
+    [S_START] = {
+        ALL_CLASSES = FI_INVALID,
+        [C_NUL] = F_EOF, [C_SPACE] = S_START, [C_NEWLINE] = S_START,
+        [C_DIGIT] = S_NUMBER, [C_LETTER] = S_WORD, [C_QUOTE] = S_STRING,
+        [C_SLASH] = S_SLASH, [C_STAR] = S_STAR, [C_PLUS] = S_PLUS,
+        [C_MINUS] = S_MINUS, [C_PERCENT] = S_PERCENT, [C_EQUALS] = S_EQUALS,
+        [C_DELIM] = FI_DELIM, [C_HIGH] = F_NON_ASCII,
+    },
+    [S_SLASH] = {
+        ALL_CLASSES = F_OPERATOR,
+        [C_SLASH] = S_LINE_COMMENT, [C_STAR] = S_BLOCK_COMMENT,
+    },
+    [S_LINE_COMMENT] = {
+        ALL_CLASSES = S_LINE_COMMENT,
+        [C_NEWLINE] = S_START, [C_NUL] = F_EOF,
+    },
+    [S_BLOCK_COMMENT] = {
+        ALL_CLASSES = S_BLOCK_COMMENT,
+        [C_STAR] = S_BLOCK_STAR, [C_NUL] = F_UNTERMINATED_COMMENT,
+    },
+    [S_BLOCK_STAR] = {
+        ALL_CLASSES = S_BLOCK_COMMENT,
+        [C_SLASH] = S_START, [C_STAR] = S_BLOCK_STAR, [C_NUL] = F_UNTERMINATED_COMMENT,
+    },
+    [S_NUMBER] = { ALL_CLASSES = F_NUMBER, [C_DIGIT] = S_NUMBER },
+    [S_WORD] = { ALL_CLASSES = F_WORD, [C_DIGIT] = S_WORD, [C_LETTER] = S_WORD },
+    [S_STRING] = {
+        ALL_CLASSES = S_STRING,
+        [C_QUOTE] = FI_STRING, [C_BACKSLASH] = S_STRING_ESCAPE,
+        [C_NUL] = F_UNTERMINATED_STRING, [C_HIGH] = S_STRING_HIGH,
+    },
+    [S_STRING_ESCAPE] = {
+        ALL_CLASSES = S_STRING,
+        [C_NUL] = F_UNTERMINATED_STRING, [C_HIGH] = S_STRING_HIGH,
+    },
+    [S_STRING_HIGH] = {
+        ALL_CLASSES = S_STRING_HIGH,
+        [C_QUOTE] = FI_STRING_HIGH, [C_BACKSLASH] = S_STRING_HIGH_ESCAPE,
+        [C_NUL] = F_UNTERMINATED_STRING,
+    },
+    [S_STRING_HIGH_ESCAPE] = { ALL_CLASSES = S_STRING_HIGH, [C_NUL] = F_UNTERMINATED_STRING },
+    [S_PLUS] = { ALL_CLASSES = F_OPERATOR, [C_PLUS] = FI_CONSECUTIVE },
+    [S_MINUS] = { ALL_CLASSES = F_OPERATOR, [C_MINUS] = FI_CONSECUTIVE },
+    [S_STAR] = { ALL_CLASSES = F_OPERATOR, [C_STAR] = FI_CONSECUTIVE },
+    [S_PERCENT] = { ALL_CLASSES = F_OPERATOR, [C_PERCENT] = FI_CONSECUTIVE },
+    [S_EQUALS] = { ALL_CLASSES = F_EQUALS, [C_EQUALS] = FI_EQUALS_EQUALS },
+};
+#pragma GCC diagnostic pop
+
+static Token next_token(Lexer *lexer) {
+    const unsigned char *base = (const unsigned char *)lexer->input;
+    const unsigned char *p = base + lexer->pos;
+    const unsigned char *start = p;
+    unsigned int state = S_START;
+    unsigned int next;
+
+    for (;;) {
+        unsigned int cls = char_class[*p];
+        next = transition[state][cls];
+        if (next >= S_COUNT) {
+            break;
+        }
+        // back in S_START the next token may begin after this byte (written
+        // without branches: this flips at every token boundary)
+        start = next == S_START ? p + 1 : start;
+        state = next;
+        p++;
+    }
 
-        // keep going until we reach the end of comment
-        while (input[*pos] != '\0') {
-            if (input[*pos] == '\n') {
-                current_line++;
+    if (next >= FI_STRING) {
+        p++;
+    }
+    lexer->pos = (int)(p - base);
+
+    Token token = {.offset = (uint32_t)(start - base), .length = (uint32_t)(p - start),
+                   .type = TOKEN_ERROR, .error = ERROR_NONE};
+    switch (next) {
+        case F_EOF:
+            token.offset = (uint32_t)lexer->pos;
+            token.length = 0;
+            token.type = TOKEN_EOF;
+            break;
+        case F_NUMBER:
+            token.type = TOKEN_NUMBER;
+            break;
+        case F_WORD:
+            if (*p >= 0x80) {
+                // may go on with non-ASCII letters; those are never keywords
+                lexer->pos = (int)(scan_identifier((const char *)p) - lexer->input);
+                token.length = (uint32_t)lexer->pos - token.offset;
             }
+            token.type = classify_word((const char *)start, token.length);
+            break;
+        case F_OPERATOR:
+            token.type = TOKEN_OPERATOR;
+            break;
+        case F_EQUALS:
+            token.type = TOKEN_EQUALS;
+            break;
+        case F_UNTERMINATED_STRING:
+            token.error = ERROR_UNTERMINATED_STRING;
+            break;
+        case F_UNTERMINATED_COMMENT:
+            token.error = ERROR_UNTERMINATED_COMMENT;
+            token.length = 2; // the opening "/*"
+            break;
+        case F_NON_ASCII:
+            token = lex_non_ascii(lexer, token);
+            break;
+        case FI_STRING:
+            token.type = TOKEN_STRING;
+            break;
+        case FI_STRING_HIGH:
+            token.type = TOKEN_STRING;
+            token = check_string_utf8(lexer->input, token);
+            break;
+        case FI_EQUALS_EQUALS:
+            token.type = TOKEN_OPERATOR;
+            break;
+        case FI_CONSECUTIVE:
+            token.error = ERROR_CONSECUTIVE_OPERATORS;
+            break;
+        case FI_DELIM:
+            token.type = (TokenType)delim_type[*start];
+            break;
+        default: // FI_INVALID
+            token.error = ERROR_INVALID_CHAR;
+            break;
+    }
+    return token;
+}
+
+#else /* !LEXER_DFA */
+
+/* Get next token from input */
+static Token next_token(Lexer *lexer) {
+    const char *input = lexer->input;
+    int *pos = &lexer->pos;
+    Token token = {.type = TOKEN_ERROR, .error = ERROR_NONE};
+    char c;
+
+    // Skip whitespace and comments. Comments loop back here instead of
+    // recursing, so any number of them takes constant stack.
+    for (;;) {
+        c = input[*pos];
 
-            if (input[*pos] == '*' && input[*pos + 1] == '/') {
-                (*pos) += 2; // skip the closing comment
-                comment_check = 1;
-                break;
+        // (most gaps are a single space, which is not worth a kernel call)
+        if (c == ' ' || c == '\n' || c == '\t') {
+            c = input[++(*pos)];
+            if (c == ' ' || c == '\n' || c == '\t') {
+                *pos = (int)(scan_whitespace(input + *pos) - input);
             }
-            (*pos)++;
+            continue;
         }
-        if (comment_check == 0) {
-            token.error = ERROR_UNTERMINATED_COMMENT;
-            return token;
+
+        // TODO: Add comment handling here
+        // Added by Lucy
+        // Handle comments
+        if (c == '/' && input[*pos + 1] == '/') {
+            *pos = (int)(scan_line_comment(input + *pos) - input); // skip everything in the comment
+            continue; // get next token
+        }
+
+        // Block comment handling by yash
+        if (c == '/' && input [*pos + 1] == '*') { // start of a block comment, edge case noted- ensure only enter block when you have sequence /*.
+            token.offset = *pos;
+            (*pos) += 2; // skip the opening comment
+
+            // keep going until we reach the end of comment
+            *pos = (int)(scan_block_comment(input + *pos) - input);
+            if (input[*pos] != '*') { // the comment is not closed
+                token.error = ERROR_UNTERMINATED_COMMENT;
+                token.length = 2; // the opening "/*"
+                return token;
             }
-        return get_next_token(input, pos); // grab next token after the comment
+            (*pos) += 2; // skip the closing comment
+            continue; // grab next token after the comment
+        }
+        break;
+    }
+
+    token.offset = *pos;
+    if (c == '\0') {
+        token.type = TOKEN_EOF;
+        return token;
     }
-    
+
     // Handle numbers
-    if (isdigit(c)) {
-        int i = 0;
-        do {
-            token.lexeme[i++] = c;
-            (*pos)++;
-            c = input[*pos];
-        } while (isdigit(c) && i < sizeof(token.lexeme) - 1);
+    if (isdigit((unsigned char)c)) {
+        *pos = (int)(scan_digits(input + *pos + 1) - input);
 
-        token.lexeme[i] = '\0';
+        token.length = *pos - token.offset;
         token.type = TOKEN_NUMBER;
         return token;
     }
@@ -166,24 +489,11 @@ Token get_next_token(const char *input, int *pos) {
     // Hint: You'll have to add support for keywords and identifiers, and then string literals
     // Added by Lucy
     // Handle keywords and identifiers
-    if (isalpha(c) || c == '_') { // variable names start with a letter or _
-        int i = 0;
-        do {
-            token.lexeme[i++] = c;
-            (*pos)++;
-            c = input[*pos];
-        } while ((isalnum(c) || c == '_') && i < sizeof(token.lexeme) - 1);
-        token.lexeme[i] = '\0';
+    if (isalpha((unsigned char)c) || c == '_') { // variable names start with a letter or _
+        *pos = (int)(scan_identifier(input + *pos + 1) - input);
+        token.length = *pos - token.offset;
         // check for keyword
-        if (strcmp(token.lexeme, "if") == 0 ||
-            strcmp(token.lexeme, "int") == 0 ||
-            strcmp(token.lexeme, "repeat") == 0 ||
-            strcmp(token.lexeme, "until") == 0) {
-            token.type = TOKEN_KEYWORD;
-            } else {
-                token.type = TOKEN_IDENTIFIER;
-            }
-        // printf("%s\n", token.lexeme);    
+        token.type = classify_word(input + token.offset, token.length);
         return token;
     }
 
@@ -192,91 +502,57 @@ Token get_next_token(const char *input, int *pos) {
     // Added by Dharsan
     // Handle string literals
     if (c == '"') {
-        // used to check if string closed
-        int close_check = 0;
-
-        int i = 0;
-        // add and skip the first quote character
-        token.lexeme[i++] = c;
+        // skip the opening quote
         (*pos)++;
         c = input[*pos];
+        unsigned char high = 0; // bit 7 set if the string has non-ASCII text
 
-        // run until last quote or end of input reached adding a character each loop
-        while (c != '"' && c != '\0' && i < sizeof(token.lexeme) - 1) {
+        // run until last quote or end of input reached
+        while (c != '"' && c != '\0') {
 
             // adds handling where string has escape sequences include them within the quotes
             // helps overcome cases where the a quotation is a part of the string
             if (c=='\\'){
-                token.lexeme[i++] = c;
                 (*pos)++;
                 c = input[*pos];
-            }
-
-            // add character and increement pointer 
-            token.lexeme[i++] = c;
-            (*pos)++;
-            c = input[*pos];
-        }
-
-        // if size is exceeded and string has not been terminated then return a buffer overlflow
-        if (i == sizeof(token.lexeme) - 1 && c!='"'){
-            // throws an error because the string is too long
-            token.error = ERROR_STRING_BUFFER_OVERFLOW;
-
-
-            // we still want to check if the string has been terminated and also remove the next bit of
-            // characters it allows tokenization of the part that is out of the string
-            while (input[*pos]!= '\0'){
-                // includes the last quote if it exists if it doesn't still throws buffer error until
-                // it is fixes/made shorter then the termination error can take over
-                if (input[*pos] == '"') {
-                    (*pos) += 1; // skip the closing comment
+                // a backslash right before the end of input escapes nothing
+                if (c == '\0') {
                     break;
-                    close_check = 1;
                 }
-                (*pos)++;
             }
-            // overrides buffer error as string actually has not been terminated and too long
-            if (close_check==0){
-                token.error = ERROR_UNTERMINATED_STRING;
-            }
-
-            return token;
+            high |= (unsigned char)c;
+            (*pos)++;
+            c = input[*pos];
         }
 
         // if the string is not terminated return an error
         if (c != '"') {
             token.error = ERROR_UNTERMINATED_STRING;
+            token.length = *pos - token.offset;
             return token;
         }
 
-        // add the last quote
-        token.lexeme[i++] = c;
+        // include the closing quote
         (*pos)++;
-        c = input[*pos];
-
-        // closes the string
-        token.lexeme[i] = '\0';
-
+        token.length = *pos - token.offset;
         token.type = TOKEN_STRING;
+        if (high & 0x80) {
+            token = check_string_utf8(input, token);
+        }
         return token;
     }
 
     // Handle operators 
     if (c == '+' || c == '-' || c == '*' || c=='/' || c == '%') { // *, /, % added by Lucy
-        // if (last_token_type == 'o') {
         if (input[*pos + 1] == c) {
             // Check for consecutive operators
             token.error = ERROR_CONSECUTIVE_OPERATORS;
-            token.lexeme[0] = c;
-            token.lexeme[1] = '\0';
+            token.length = 2;
             (*pos)+=2;
             return token;
         }
         token.type = TOKEN_OPERATOR;
-        token.lexeme[0] = c;
-        token.lexeme[1] = '\0';
-        last_token_type = 'o';
+        token.length = 1;
         (*pos)++;
         return token;
     }
@@ -285,21 +561,28 @@ Token get_next_token(const char *input, int *pos) {
     // Handle assignment and comparison operators
     if (c == '=') {
         token.type = TOKEN_EQUALS;
-        token.lexeme[0] = c;
-        token.lexeme[1] = '\0';
+        token.length = 1;
         (*pos)++;
 
         // Check for "==" (comparison operator)
         if (input[*pos] == '=') {
             token.type = TOKEN_OPERATOR;
-            token.lexeme[1] = '=';
-            token.lexeme[2] = '\0';
+            token.length = 2;
             (*pos)++;
         }
 
         return token;
     }
 
+    // Comparison operators. There is no << or >>, so unlike the arithmetic
+    // operators a doubled one is not an error here; the parser rejects it.
+    if (c == '<' || c == '>') {
+        token.type = TOKEN_OPERATOR;
+        token.length = 1;
+        (*pos)++;
+        return token;
+    }
+
 
     // TODO: Add delimiter handling here
     // Added by Lucy
@@ -317,22 +600,349 @@ Token get_next_token(const char *input, int *pos) {
             token.type = TOKEN_RBRACE;  // for right brace
         }
         
-        token.lexeme[0] = c;
-        token.lexeme[1] = '\0';  // Null-terminate the lexeme string
+        token.length = 1;
         (*pos)++;  // Move the position forward regardless of the character
         
         return token;  // Return the token
     }
 
 
+    if ((unsigned char)c >= 0x80) {
+        return lex_non_ascii(lexer, token);
+    }
+
     // Handle invalid characters
     token.error = ERROR_INVALID_CHAR;
-    token.lexeme[0] = c;
-    token.lexeme[1] = '\0';
+    token.length = 1;
     (*pos)++;
     return token;
 }
 
+#endif /* LEXER_DFA */
+
+void lexer_init(Lexer *lexer, const char *input) {
+    lexer->input = input;
+    lexer->pos = 0;
+    lexer->errors = 0;
+    lexer->error = ERROR_NONE;
+}
+
+Token lexer_next_token(Lexer *lexer) {
+    Token token = next_token(lexer);
+    if (token.error != ERROR_NONE) {
+        lexer->errors++;
+        lexer->error = token.error;
+    }
+    return token;
+}
+
+/* Streaming lexer
+ * Pulls the input through a fixed-size window instead of requiring the whole
+ * program in memory. Whitespace and comments are skipped here chunk by chunk
+ * (they can be arbitrarily long); each token is then lexed by next_token on
+ * the window. A token that runs into the end of the window is lexed again
+ * after the window has been refilled starting at its first byte, and one that
+ * is longer than the whole window is scanned to its end chunk by chunk. Memory
+ * use is sizeof(StreamLexer) regardless of the input size.
+ */
+#ifndef STREAM_BUFFER_SIZE
+#define STREAM_BUFFER_SIZE (64 * 1024)
+#endif
+#define STREAM_LOOKAHEAD 4096
+#define STREAM_CHAR_MAX 4          // bytes in the longest UTF-8 character
+
+struct StreamLexer {
+    LexerReadFn read;
+    void *ctx;
+    size_t pos;                 // next unread byte in buf
+    size_t end;                 // number of valid bytes in buf
+    unsigned long long offset;  // absolute input offset of buf[0]
+    unsigned long long counted; // newlines are counted up to this input offset
+    unsigned long long line_start; // input offset of the line counted up to
+    int line;                   // ... and its number
+    SourceLocation where;       // location of the last token, if located early
+    int located;                // where is set
+    int eof;                    // read callback reported end of input
+    int io_error;               // read callback reported an error
+    int spilled;                // last token was longer than the window
+    char buf[STREAM_BUFFER_SIZE + 1]; // +1 for the '\0' sentinel after buf[end]
+};
+
+static long read_fd(void *ctx, char *buf, size_t cap) {
+    int fd = *(int *)ctx;
+    for (;;) {
+        ssize_t n = read(fd, buf, cap);
+        if (n >= 0 || errno != EINTR) {
+            return (long)n;
+        }
+    }
+}
+
+StreamLexer *stream_lexer_open(LexerReadFn read_fn, void *ctx) {
+    StreamLexer *lx = malloc(sizeof(StreamLexer));
+    if (lx) {
+        lx->read = read_fn;
+        lx->ctx = ctx;
+        lx->pos = 0;
+        lx->end = 0;
+        lx->offset = 0;
+        lx->counted = 0;
+        lx->line_start = 0;
+        lx->line = 1;
+        lx->located = 0;
+        lx->eof = 0;
+        lx->io_error = 0;
+        lx->spilled = 0;
+        lx->buf[0] = '\0';
+    }
+    return lx;
+}
+
+StreamLexer *stream_lexer_open_fd(int fd) {
+    int *ctx = malloc(sizeof(int));
+    if (!ctx) {
+        return NULL;
+    }
+    *ctx = fd;
+    StreamLexer *lx = stream_lexer_open(read_fd, ctx);
+    if (!lx) {
+        free(ctx);
+        return NULL;
+    }
+    return lx;
+}
+
+void stream_lexer_close(StreamLexer *lx) {
+    if (!lx) return;
+    if (lx->read == read_fd) {
+        free(lx->ctx);
+    }
+    free(lx);
+}
+
+unsigned long long stream_lexer_offset(const StreamLexer *lx) {
+    return lx->offset + lx->pos;
+}
+
+int stream_lexer_error(const StreamLexer *lx) {
+    return lx->io_error;
+}
+
+size_t stream_token_text(const StreamLexer *lx, const Token *token, const char **text) {
+    *text = lx->buf + token->offset;
+    return lx->spilled ? 0 : token->length;
+}
+
+// Location of buf[pos], counting the lines up to it. Lines are only ever
+// counted forward: at the latest when bytes leave the window, otherwise when a
+// location is asked for.
+static SourceLocation stream_locate(StreamLexer *lx, size_t pos) {
+    unsigned long long at = lx->offset + pos;
+    if (at > lx->counted) {
+        size_t from = (size_t)(lx->counted - lx->offset);
+        size_t line_start = 0;
+        size_t n = count_newlines(lx->buf + from, pos - from, &line_start);
+        if (n > 0) {
+            lx->line += (int)n;
+            lx->line_start = lx->offset + from + line_start;
+        }
+        lx->counted = at;
+    }
+    SourceLocation where = {lx->line, (int)(at - lx->line_start) + 1};
+    return where;
+}
+
+SourceLocation stream_token_location(StreamLexer *lx, const Token *token) {
+    return lx->located ? lx->where : stream_locate(lx, token->offset);
+}
+
+// Make at least want bytes available after pos (fewer only at end of input).
+// Returns the number of bytes available.
+static size_t stream_fill(StreamLexer *lx, size_t want) {
+    if (want > STREAM_BUFFER_SIZE) {
+        want = STREAM_BUFFER_SIZE;
+    }
+    if (lx->end - lx->pos >= want || lx->eof) {
+        return lx->end - lx->pos;
+    }
+
+    // slide the unread tail to the front of the window
+    stream_locate(lx, lx->pos);
+    size_t keep = lx->end - lx->pos;
+    memmove(lx->buf, lx->buf + lx->pos, keep);
+    lx->offset += lx->pos;
+    lx->pos = 0;
+    lx->end = keep;
+
+    while (lx->end < want && !lx->eof) {
+        long n = lx->read(lx->ctx, lx->buf + lx->end, STREAM_BUFFER_SIZE - lx->end);
+        if (n <= 0) {
+            lx->eof = 1;
+            lx->io_error = n < 0;
+        } else {
+            lx->end += (size_t)n;
+        }
+    }
+    lx->buf[lx->end] = '\0';
+    return lx->end;
+}
+
+// Byte at pos + k, '\0' past the end of input
+static char stream_peek(StreamLexer *lx, size_t k) {
+    if (stream_fill(lx, k + 1) <= k) {
+        return '\0';
+    }
+    return lx->buf[lx->pos + k];
+}
+
+// Finish a token that did not fit in the window: the window holds its first
+// STREAM_BUFFER_SIZE bytes (bar a cut character), keep consuming the input
+// from pos until the token ends
+static void stream_spill_token(StreamLexer *lx, Token *token) {
+    Utf8Stream text = UTF8_STREAM_INIT; // a string's UTF-8 so far
+    int valid = 1;
+    int escaped = 0;
+    char c;
+
+    if (token->error == ERROR_UNTERMINATED_STRING) {
+        // an odd run of backslashes at the end of the window leaves the
+        // escape of the next character pending
+        size_t i = lx->end;
+        while (i > 1 && lx->buf[i - 1] == '\\') {
+            i--;
+        }
+        escaped = (lx->end - i) % 2;
+        for (i = token->offset + 1; i < lx->end; i++) {
+            valid &= utf8_feed(&text, (unsigned char)lx->buf[i]);
+        }
+    }
+
+    lx->spilled = 1; // lexing goes on from pos, where the window ran out
+    while ((c = stream_peek(lx, 0)) != '\0') {
+        if (token->type == TOKEN_NUMBER) {
+            if (!isdigit((unsigned char)c)) break;
+        } else if (token->type == TOKEN_IDENTIFIER) {
+            if ((unsigned char)c >= 0x80) {
+                stream_fill(lx, 4); // the whole character
+                int n = utf8_identifier_char(lx->buf + lx->pos, 0);
+                if (n == 0) break;
+                lx->pos += (size_t)n;
+                token->length += (uint32_t)n;
+                continue;
+            }
+            if (!isalnum((unsigned char)c) && c != '_') break;
+        } else if (escaped) {
+            escaped = 0;
+        } else if (c == '\\') {
+            escaped = 1;
+        } else if (c == '"') {
+            lx->pos++;
+            token->length++;
+            if (valid && UTF8_COMPLETE(text)) {
+                token->type = TOKEN_STRING;
+                token->error = ERROR_NONE;
+            } else {
+                token->error = ERROR_INVALID_UTF8;
+            }
+            break;
+        }
+        if (token->type != TOKEN_NUMBER && token->type != TOKEN_IDENTIFIER) {
+            valid &= utf8_feed(&text, (unsigned char)c);
+        }
+        lx->pos++;
+        token->length++;
+    }
+}
+
+// Lex one token from the window, starting at pos
+static Token stream_lex_window(StreamLexer *lx, Lexer *window) {
+    lexer_init(window, lx->buf);
+    window->pos = (int)lx->pos;
+    return next_token(window);
+}
+
+Token stream_next_token(StreamLexer *lx) {
+    Token token = {.type = TOKEN_ERROR, .error = ERROR_NONE};
+    Lexer window;
+    char c;
+
+    lx->spilled = 0;
+    lx->located = 0;
+
+    // Skip whitespace and comments like next_token does
+    for (;;) {
+        // the window is '\0'-terminated, so the scanners stop at its end at
+        // the latest and stream_peek refills it
+        c = stream_peek(lx, 0);
+        if (c == ' ' || c == '\t' || c == '\n') {
+            lx->pos = (size_t)(scan_whitespace(lx->buf + lx->pos) - lx->buf);
+        } else if (c == '/' && stream_peek(lx, 1) == '/') {
+            while ((c = stream_peek(lx, 0)) != '\n' && c != '\0') {
+                lx->pos = (size_t)(scan_line_comment(lx->buf + lx->pos) - lx->buf);
+            }
+        } else if (c == '/' && stream_peek(lx, 1) == '*') {
+            // the opening "/*" may have left the window by the time the
+            // comment turns out to be unterminated
+            SourceLocation opening = stream_locate(lx, lx->pos);
+            lx->pos += 2;
+            int comment_check = 0;
+            while ((c = stream_peek(lx, 0)) != '\0') {
+                if (c == '*' && stream_peek(lx, 1) == '/') {
+                    lx->pos += 2;
+                    comment_check = 1;
+                    break;
+                }
+                const char *from = lx->buf + lx->pos + (c == '*');
+                const char *stop = scan_block_comment(from);
+                // a '*' at the end of the window may be closed by the next chunk
+                if (stop > from && stop == lx->buf + lx->end && stop[-1] == '*') {
+                    stop--;
+                }
+                lx->pos = (size_t)(stop - lx->buf);
+            }
+            if (comment_check == 0) {
+                token.offset = lx->pos;
+                token.error = ERROR_UNTERMINATED_COMMENT;
+                lx->where = opening;
+                lx->located = 1;
+                return token;
+            }
+        } else {
+            break;
+        }
+    }
+
+    if (c == '\0') {
+        token.offset = lx->pos;
+        token.type = TOKEN_EOF;
+        return token;
+    }
+
+    stream_fill(lx, STREAM_LOOKAHEAD);
+    token = stream_lex_window(lx, &window);
+
+    // Ran into the end of the window, or stopped short of it at a character
+    // the window may have cut in two: refill it from the token's first byte
+    // and lex the token again
+    if (lx->end - (size_t)window.pos < STREAM_CHAR_MAX && !lx->eof) {
+        stream_fill(lx, STREAM_BUFFER_SIZE);
+        token = stream_lex_window(lx, &window);
+
+        // Still no end in sight: the token is longer than the window
+        if (lx->end - (size_t)window.pos < STREAM_CHAR_MAX && !lx->eof &&
+            (token.type == TOKEN_NUMBER || token.type == TOKEN_IDENTIFIER ||
+             token.error == ERROR_UNTERMINATED_STRING)) {
+            lx->where = stream_locate(lx, token.offset);
+            lx->located = 1;
+            lx->pos = (size_t)window.pos;
+            stream_spill_token(lx, &token);
+            return token;
+        }
+    }
+    lx->pos = (size_t)window.pos;
+    return token;
+}
+
 // This is a basic lexer that handles numbers (e.g., "123", "456"), basic operators (+ and -), consecutive operator errors, whitespace and newlines, with simple line tracking for error reporting.
 
 // int main() {
@@ -0,0 +1,379 @@
+/* parallel.c - lex one large input on several threads */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/lexer.h"
+#include "../../include/scan.h"
+
+/* The input is cut at line starts into one chunk per thread and every chunk is
+ * lexed on its own. A line start is always between tokens except when a block
+ * comment or a string literal runs across it, so each thread lexes its chunk
+ * three times over: assuming it starts in the normal state, inside a block
+ * comment, and inside a string. The two speculative runs stop as soon as they
+ * produce a token the normal run also produced (from there on the runs agree)
+ * or after SPECULATE_BYTES, so they cost little.
+ *
+ * A sequential fix-up pass then walks the chunks in order. Knowing where the
+ * previous chunk's last token ended, it picks whichever run has a token
+ * starting at the same spot and takes the tokens from there. Should no run fit
+ * (a speculation gave up early), it lexes on from that spot until it meets the
+ * normal run. Finally the chosen pieces are copied out in parallel.
+ */
+
+#ifndef SPECULATE_BYTES
+#define SPECULATE_BYTES (16 * 1024)
+#endif
+#ifndef MIN_CHUNK_SIZE
+#define MIN_CHUNK_SIZE (64 * 1024)   // smaller inputs use fewer threads
+#endif
+
+enum { RUN_NORMAL, RUN_COMMENT, RUN_STRING, RUN_COUNT };
+
+// Tokens lexed from one starting point of a chunk
+typedef struct {
+    Token *tokens;
+    size_t count;
+    size_t cap;
+    int from;       // position the run starts lexing at in the normal state
+    int stop;       // offset of the first token at or past the chunk end,
+                    // -1 if the run reached TOKEN_EOF, -2 if it gave up
+    int resume;     // where a run that gave up stopped
+    int join;       // speculative runs: index into the normal run of the token
+                    // where this run met it, -1 if it did not
+    size_t hint;    // expected number of tokens
+} TokenRun;
+
+// Part of the final token stream
+typedef struct {
+    const Token *tokens;
+    size_t count;
+} Segment;
+
+typedef struct {
+    const char *input;
+    int start;              // the chunk is input[start, end)
+    int end;
+    int failed;             // out of memory
+    TokenRun run[RUN_COUNT];
+    TokenRun fixup;         // tokens lexed by the fix-up pass
+    Segment segment[3];     // what the chunk contributes, in order
+    int segments;
+    TokenBuffer *out;       // where the segments are copied to
+    size_t out_index;       // ... starting at this token
+    int errors;             // error tokens among them
+} Chunk;
+
+static int run_push(TokenRun *run, Token token) {
+    if (run->count == run->cap) {
+        size_t cap = run->cap ? run->cap * 2 : 256;
+        if (cap < run->hint) cap = run->hint;
+        Token *tokens = realloc(run->tokens, cap * sizeof(Token));
+        if (!tokens) return 0;
+        run->tokens = tokens;
+        run->cap = cap;
+    }
+    run->tokens[run->count++] = token;
+    return 1;
+}
+
+// Index of the token of run that starts at offset, -1 if there is none
+static int find_offset(const TokenRun *run, int offset) {
+    size_t lo = 0;
+    size_t hi = run->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if ((int)run->tokens[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < run->count && (int)run->tokens[lo].offset == offset ? (int)lo : -1;
+}
+
+// Where a chunk that starts inside a block comment gets back to the normal
+// state
+static int skip_comment_body(const char *input, int pos) {
+    const char *p = scan_block_comment(input + pos);
+    return (int)(p - input) + (*p == '*' ? 2 : 0);
+}
+
+// Same for a chunk starting inside a string literal (mirrors next_token)
+static int skip_string_body(const char *input, int pos) {
+    char c;
+    while ((c = input[pos]) != '"' && c != '\0') {
+        if (c == '\\') {
+            c = input[++pos];
+            if (c == '\0') {
+                break;
+            }
+        }
+        pos++;
+    }
+    return c == '"' ? pos + 1 : pos;
+}
+
+// Lex from run->from until a token starts at or past the chunk end. With a
+// normal run to compare against, also stop at the first token that run has
+// too, or once SPECULATE_BYTES have gone by.
+static int lex_run(const Chunk *c, TokenRun *run, const TokenRun *normal) {
+    Lexer lexer;
+    lexer_init(&lexer, c->input);
+    lexer.pos = run->from;
+    run->join = -1;
+
+    for (;;) {
+        Token token = lexer_next_token(&lexer);
+        if ((int)token.offset >= c->end) {
+            run->stop = (int)token.offset;
+            return 1;
+        }
+        if (normal) {
+            run->join = find_offset(normal, (int)token.offset);
+            if (run->join >= 0) {
+                run->stop = normal->stop;
+                return 1;
+            }
+        }
+        if (!run_push(run, token)) {
+            return 0;
+        }
+        if (token.type == TOKEN_EOF) {
+            run->stop = -1;
+            return 1;
+        }
+        if (normal && lexer.pos - run->from > SPECULATE_BYTES) {
+            run->stop = -2;
+            run->resume = lexer.pos;
+            return 1;
+        }
+    }
+}
+
+static void *lex_chunk(void *arg) {
+    Chunk *c = arg;
+    int ok;
+
+    // about one token per 4 bytes of source; pages of the array that are
+    // never written are never touched
+    c->run[RUN_NORMAL].hint = (size_t)(c->end - c->start) / 4 + 16;
+    c->run[RUN_NORMAL].from = c->start;
+    ok = lex_run(c, &c->run[RUN_NORMAL], NULL);
+
+    // the first chunk can only start in the normal state
+    if (ok && c->start > 0) {
+        c->run[RUN_COMMENT].from = skip_comment_body(c->input, c->start);
+        ok = lex_run(c, &c->run[RUN_COMMENT], &c->run[RUN_NORMAL]);
+
+        c->run[RUN_STRING].from = skip_string_body(c->input, c->start);
+        ok = ok && lex_run(c, &c->run[RUN_STRING], &c->run[RUN_NORMAL]);
+    }
+    c->failed = !ok;
+    return NULL;
+}
+
+static void add_segment(Chunk *c, const TokenRun *run, size_t from, size_t to) {
+    if (from < to) {
+        Segment *s = &c->segment[c->segments++];
+        s->tokens = run->tokens + from;
+        s->count = to - from;
+    }
+}
+
+// Lex sequentially from pos (in the normal state) until meeting the normal
+// run or leaving the chunk; returns the next chunk's first token offset
+static int catch_up(Chunk *c, int pos) {
+    const TokenRun *normal = &c->run[RUN_NORMAL];
+    TokenRun *fixup = &c->fixup;
+    Lexer lexer;
+    int next;
+
+    lexer_init(&lexer, c->input);
+    lexer.pos = pos;
+
+    for (;;) {
+        Token token = lexer_next_token(&lexer);
+        if ((int)token.offset >= c->end) {
+            next = (int)token.offset;
+            break;
+        }
+        int join = find_offset(normal, (int)token.offset);
+        if (join >= 0) {
+            add_segment(c, fixup, 0, fixup->count);
+            add_segment(c, normal, (size_t)join, normal->count);
+            return normal->stop;
+        }
+        if (!run_push(fixup, token)) {
+            c->failed = 1;
+            return -1;
+        }
+        if (token.type == TOKEN_EOF) {
+            next = -1;
+            break;
+        }
+    }
+    add_segment(c, fixup, 0, fixup->count);
+    return next;
+}
+
+// Pick the tokens of chunk c given that the next token starts at offset next;
+// returns the offset where the chunk after it has to continue
+static int fix_up(Chunk *c, int next) {
+    const TokenRun *normal = &c->run[RUN_NORMAL];
+    int k = find_offset(normal, next);
+
+    if (k >= 0) {
+        add_segment(c, normal, (size_t)k, normal->count);
+        return normal->stop;
+    }
+
+    for (int r = RUN_COMMENT; r < RUN_COUNT; r++) {
+        const TokenRun *spec = &c->run[r];
+        k = find_offset(spec, next);
+        if (k < 0) {
+            continue;
+        }
+        add_segment(c, spec, (size_t)k, spec->count);
+        if (spec->join >= 0) {
+            add_segment(c, normal, (size_t)spec->join, normal->count);
+            return normal->stop;
+        }
+        if (spec->stop != -2) {
+            return spec->stop;
+        }
+        next = spec->resume; // the speculation gave up, go on from where it was
+        break;
+    }
+
+    return catch_up(c, next);
+}
+
+static void *copy_chunk(void *arg) {
+    Chunk *c = arg;
+    TokenBuffer *out = c->out;
+    size_t k = c->out_index;
+    for (int i = 0; i < c->segments; i++) {
+        const Segment *s = &c->segment[i];
+        for (size_t j = 0; j < s->count; j++, k++) {
+            const Token *token = &s->tokens[j];
+            out->type[k] = token->type;
+            out->error[k] = token->error;
+            out->offset[k] = token->offset;
+            out->length[k] = token->length;
+            c->errors += token->error != ERROR_NONE;
+        }
+    }
+    return NULL;
+}
+
+// Run fn on every chunk, one thread each (the first on the calling thread)
+static void run_threads(Chunk *chunks, int n, void *(*fn)(void *)) {
+    pthread_t *threads = malloc((size_t)n * sizeof(pthread_t));
+    char *started = calloc((size_t)n, 1);
+
+    for (int i = 1; i < n; i++) {
+        if (threads && started) {
+            started[i] = pthread_create(&threads[i], NULL, fn, &chunks[i]) == 0;
+        }
+    }
+    fn(&chunks[0]);
+    for (int i = 1; i < n; i++) {
+        if (threads && started && started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            fn(&chunks[i]); // could not start a thread, do it here
+        }
+    }
+    free(threads);
+    free(started);
+}
+
+static void free_chunks(Chunk *chunks, int n) {
+    for (int i = 0; i < n; i++) {
+        for (int r = 0; r < RUN_COUNT; r++) {
+            free(chunks[i].run[r].tokens);
+        }
+        free(chunks[i].fixup.tokens);
+    }
+    free(chunks);
+}
+
+int lex_parallel(TokenBuffer *buffer, const char *input, size_t size, int threads) {
+    // the lexer stops at the first '\0', so does everything here
+    const char *nul = memchr(input, '\0', size);
+    int length = nul ? (int)(nul - input) : (int)size;
+
+    int n = threads < 1 ? 1 : threads;
+    if (n > length / MIN_CHUNK_SIZE + 1) {
+        n = length / MIN_CHUNK_SIZE + 1;
+    }
+
+    token_buffer_init(buffer, input);
+    Chunk *chunks = calloc((size_t)n, sizeof(Chunk));
+    if (!chunks) {
+        return 0;
+    }
+
+    // cut right after a '\n' at or past each even split point
+    int start = 0;
+    for (int i = 0; i < n; i++) {
+        int end = length + 1; // the last chunk also holds TOKEN_EOF
+        if (i < n - 1) {
+            end = (int)((long long)length * (i + 1) / n);
+            if (end < start) end = start;
+            const char *newline = memchr(input + end, '\n', (size_t)(length - end));
+            end = newline ? (int)(newline - input) + 1 : length;
+        }
+        chunks[i].input = input;
+        chunks[i].start = start;
+        chunks[i].end = end;
+        start = end;
+    }
+
+    scan_kernel_name(); // bind the scanners before the threads race to do it
+    run_threads(chunks, n, lex_chunk);
+
+    // sequential fix-up: choose each chunk's tokens and where they go. The
+    // first chunk starts in the normal state, so its normal run is right.
+    const TokenRun *first = &chunks[0].run[RUN_NORMAL];
+    size_t total = 0;
+    int next = first->count ? (int)first->tokens[0].offset : first->stop;
+    for (int i = 0; i < n; i++) {
+        Chunk *c = &chunks[i];
+        if (c->failed) {
+            free_chunks(chunks, n);
+            return 0;
+        }
+        if (next >= c->start && next < c->end) {
+            next = fix_up(c, next);
+            if (c->failed) {
+                free_chunks(chunks, n);
+                return 0;
+            }
+        }
+        for (int s = 0; s < c->segments; s++) {
+            total += c->segment[s].count;
+        }
+    }
+
+    if (!token_buffer_reserve(buffer, total)) {
+        free_chunks(chunks, n);
+        return 0;
+    }
+    size_t index = 0;
+    for (int i = 0; i < n; i++) {
+        chunks[i].out = buffer;
+        chunks[i].out_index = index;
+        for (int s = 0; s < chunks[i].segments; s++) {
+            index += chunks[i].segment[s].count;
+        }
+    }
+    run_threads(chunks, n, copy_chunk);
+
+    buffer->count = total;
+    for (int i = 0; i < n; i++) {
+        buffer->errors += chunks[i].errors;
+    }
+    free_chunks(chunks, n);
+    return 1;
+}
@@ -0,0 +1,152 @@
+/* pipe.c - lexer running ahead of its reader on a thread of its own */
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "../../include/lexer.h"
+#include "../../include/scan.h"
+
+/* The lexer thread and the reader share a ring of PIPE_SIZE tokens with one
+ * writer and one reader, so it needs no lock: the lexer only ever moves tail,
+ * the reader only ever moves head, and each publishes its index with a release
+ * store that the other picks up with an acquire load. Both keep a private copy
+ * of the other side's index and only reload it when that copy says the ring is
+ * full (lexer) or empty (reader), so in the steady state neither touches the
+ * other's cache line.
+ *
+ * The lexer fills PIPE_BATCH tokens at a time into a private array and copies
+ * the batch into the ring once there is room for all of it. A full ring makes
+ * it wait (back-pressure), an empty one makes the reader wait. Waiting spins
+ * briefly and then yields the CPU, which matters when both threads share one
+ * core.
+ */
+
+#ifndef PIPE_SIZE
+#define PIPE_SIZE 4096      // tokens, a power of two
+#endif
+#ifndef PIPE_BATCH
+#define PIPE_BATCH 256
+#endif
+#define PIPE_SPINS 64
+
+_Static_assert((PIPE_SIZE & (PIPE_SIZE - 1)) == 0, "PIPE_SIZE must be a power of two");
+_Static_assert(PIPE_BATCH < PIPE_SIZE, "PIPE_BATCH must be smaller than PIPE_SIZE");
+
+struct TokenPipe {
+    // written by the lexer thread
+    _Alignas(64) atomic_size_t tail;    // tokens published
+    atomic_int done;                    // the last token (TOKEN_EOF) is published
+    size_t head_seen;                   // lexer's copy of head
+
+    // written by the reader
+    _Alignas(64) atomic_size_t head;    // tokens consumed
+    atomic_int stop;                    // reader closed the pipe early
+    size_t tail_seen;                   // reader's copy of tail
+
+    _Alignas(64) Token ring[PIPE_SIZE];
+    Lexer lexer;
+    pthread_t thread;
+};
+
+static void pause_or_yield(int *spins) {
+    if (++*spins < PIPE_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+static void *lex_ahead(void *arg) {
+    TokenPipe *pipe = arg;
+    Token batch[PIPE_BATCH];
+    size_t tail = 0;
+    int last = 0;
+
+    while (!last) {
+        size_t n = 0;
+        while (n < PIPE_BATCH && !last) {
+            batch[n] = lexer_next_token(&pipe->lexer);
+            last = batch[n++].type == TOKEN_EOF;
+        }
+
+        // wait for room for the whole batch
+        int spins = 0;
+        while (tail + n - pipe->head_seen > PIPE_SIZE) {
+            if (atomic_load_explicit(&pipe->stop, memory_order_relaxed)) {
+                return NULL;
+            }
+            pipe->head_seen = atomic_load_explicit(&pipe->head, memory_order_acquire);
+            if (tail + n - pipe->head_seen > PIPE_SIZE) {
+                pause_or_yield(&spins);
+            }
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            pipe->ring[(tail + i) & (PIPE_SIZE - 1)] = batch[i];
+        }
+        tail += n;
+        atomic_store_explicit(&pipe->tail, tail, memory_order_release);
+    }
+    atomic_store_explicit(&pipe->done, 1, memory_order_release);
+    return NULL;
+}
+
+TokenPipe *token_pipe_open(const char *source) {
+    TokenPipe *pipe = aligned_alloc(64, sizeof(TokenPipe));
+    if (!pipe) {
+        return NULL;
+    }
+    atomic_init(&pipe->tail, 0);
+    atomic_init(&pipe->done, 0);
+    atomic_init(&pipe->head, 0);
+    atomic_init(&pipe->stop, 0);
+    pipe->head_seen = 0;
+    pipe->tail_seen = 0;
+    lexer_init(&pipe->lexer, source);
+
+    scan_kernel_name(); // bind the scanners before the lexer thread uses them
+    if (pthread_create(&pipe->thread, NULL, lex_ahead, pipe) != 0) {
+        free(pipe);
+        return NULL;
+    }
+    return pipe;
+}
+
+Token token_pipe_peek(TokenPipe *pipe, size_t k) {
+    size_t head = atomic_load_explicit(&pipe->head, memory_order_relaxed);
+    size_t want = head + k + 1;
+    int spins = 0;
+
+    while (pipe->tail_seen < want) {
+        // read done before tail: once done is set, tail is final
+        int done = atomic_load_explicit(&pipe->done, memory_order_acquire);
+        pipe->tail_seen = atomic_load_explicit(&pipe->tail, memory_order_acquire);
+        if (pipe->tail_seen >= want) {
+            break;
+        }
+        if (done) {
+            want = pipe->tail_seen; // past the end: the final TOKEN_EOF
+            break;
+        }
+        pause_or_yield(&spins);
+    }
+    return pipe->ring[(want - 1) & (PIPE_SIZE - 1)];
+}
+
+void token_pipe_advance(TokenPipe *pipe) {
+    Token token = token_pipe_peek(pipe, 0); // waits for the token to exist
+    if (token.type != TOKEN_EOF) {
+        size_t head = atomic_load_explicit(&pipe->head, memory_order_relaxed);
+        atomic_store_explicit(&pipe->head, head + 1, memory_order_release);
+    }
+}
+
+int token_pipe_close(TokenPipe *pipe) {
+    atomic_store_explicit(&pipe->stop, 1, memory_order_relaxed);
+    pthread_join(pipe->thread, NULL);
+    int errors = pipe->lexer.errors;
+    free(pipe);
+    return errors;
+}
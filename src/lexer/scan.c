@@ -0,0 +1,540 @@
+/* scan.c - vectorized byte-run scanners for the lexer */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "../../include/scan.h"
+#include "../../include/utf8.h"
+
+#if defined(__x86_64__) && !defined(LEXER_SCALAR)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* The vector kernels use aligned loads only. An aligned 16 or 32 byte block
+ * never straddles a page boundary, so reading the whole block that holds the
+ * '\0' terminator cannot fault even though it may read a few bytes past the
+ * end of the buffer; those bytes are masked off and never looked at. Address
+ * sanitizer cannot know that, hence SCAN_NOSAN.
+ */
+#if defined(__clang__) || defined(__GNUC__)
+#define SCAN_NOSAN __attribute__((no_sanitize_address))
+#define SCAN_INLINE static inline __attribute__((always_inline))
+#else
+#define SCAN_NOSAN
+#define SCAN_INLINE static inline
+#endif
+
+typedef struct {
+    const char* name;
+    const char* (*whitespace)(const char* p);
+    const char* (*line_comment)(const char* p);
+    const char* (*block_comment)(const char* p);
+    const char* (*word)(const char* p);
+    const char* (*digits)(const char* p);
+    int (*utf8_valid)(const char* p, size_t n);
+} ScanKernels;
+
+/* Scalar kernels */
+
+static int is_word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_';
+}
+
+static const char* scalar_whitespace(const char* p) {
+    while (*p == ' ' || *p == '\n' || *p == '\t') p++;
+    return p;
+}
+
+static const char* scalar_line_comment(const char* p) {
+    while (*p != '\n' && *p != '\0') p++;
+    return p;
+}
+
+static const char* scalar_block_comment(const char* p) {
+    while (*p != '\0' && !(*p == '*' && p[1] == '/')) p++;
+    return p;
+}
+
+static const char* scalar_word(const char* p) {
+    while (is_word_char(*p)) p++;
+    return p;
+}
+
+static const char* scalar_digits(const char* p) {
+    while (*p >= '0' && *p <= '9') p++;
+    return p;
+}
+
+// Validate from p[i], the first byte >= 0x80 of a block, until back on ASCII;
+// returns the index after that or 0 if the text is not well-formed
+static size_t utf8_run(const char* p, size_t i, size_t n) {
+    uint32_t cp;
+    while (i < n && (unsigned char)p[i] >= 0x80) {
+        int length = utf8_decode(p + i, n - i, &cp);
+        if (!length) return 0;
+        i += (size_t)length;
+    }
+    return i;
+}
+
+static int scalar_utf8_valid(const char* p, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        uint64_t word;
+        if (n - i >= 8) {
+            memcpy(&word, p + i, 8);
+            if (!(word & 0x8080808080808080u)) {
+                i += 8;
+                continue;
+            }
+        }
+        if ((unsigned char)p[i] < 0x80) {
+            i++;
+        } else if (!(i = utf8_run(p, i, n))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static const ScanKernels scalar_kernels = {
+    "scalar", scalar_whitespace, scalar_line_comment, scalar_block_comment,
+    scalar_word, scalar_digits, scalar_utf8_valid
+};
+
+#ifdef SCAN_X86
+
+// What a kernel scans over; the mask functions return the bytes that END it
+enum { RUN_WHITESPACE, RUN_LINE_COMMENT, RUN_BLOCK_COMMENT, RUN_WORD, RUN_DIGITS };
+
+/* SSE2 kernels (16 bytes per step) */
+
+// Bytes in [lo, hi]; bytes >= 0x80 compare as negative and never match
+SCAN_INLINE SCAN_NOSAN __m128i sse2_in_range(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char)(lo - 1))),
+                         _mm_cmpgt_epi8(_mm_set1_epi8((char)(hi + 1)), v));
+}
+
+SCAN_INLINE SCAN_NOSAN uint32_t sse2_stop_mask(__m128i v, int kind) {
+    __m128i newline = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+    __m128i stop;
+
+    switch (kind) {
+        case RUN_WHITESPACE: {
+            __m128i ws = _mm_or_si128(newline,
+                         _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                      _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+            return ~(uint32_t)_mm_movemask_epi8(ws) & 0xFFFFu;
+        }
+        case RUN_LINE_COMMENT:
+            stop = _mm_or_si128(newline, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+            return (uint32_t)_mm_movemask_epi8(stop);
+        case RUN_BLOCK_COMMENT:
+            stop = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('*')),
+                                _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+            return (uint32_t)_mm_movemask_epi8(stop);
+        case RUN_WORD: {
+            // (c | 0x20) folds upper case onto lower case
+            __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+            __m128i word = _mm_or_si128(sse2_in_range(v, '0', '9'),
+                           _mm_or_si128(sse2_in_range(lower, 'a', 'z'),
+                                        _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))));
+            return ~(uint32_t)_mm_movemask_epi8(word) & 0xFFFFu;
+        }
+        default: // RUN_DIGITS
+            return ~(uint32_t)_mm_movemask_epi8(sse2_in_range(v, '0', '9')) & 0xFFFFu;
+    }
+}
+
+SCAN_INLINE SCAN_NOSAN const char* sse2_run(const char* p, int kind) {
+    uintptr_t skew = (uintptr_t)p & 15;
+    const char* block = p - skew;
+    uint32_t keep = 0xFFFFu << skew; // ignore the bytes in front of p
+
+    for (;;) {
+        uint32_t stop = sse2_stop_mask(_mm_load_si128((const __m128i*)block), kind) & keep;
+        if (stop) {
+            return block + __builtin_ctz(stop);
+        }
+        block += 16;
+        keep = 0xFFFFu;
+    }
+}
+
+static SCAN_NOSAN const char* sse2_whitespace(const char* p) {
+    return sse2_run(p, RUN_WHITESPACE);
+}
+
+static SCAN_NOSAN const char* sse2_line_comment(const char* p) {
+    return sse2_run(p, RUN_LINE_COMMENT);
+}
+
+static SCAN_NOSAN const char* sse2_block_comment(const char* p) {
+    for (;;) {
+        p = sse2_run(p, RUN_BLOCK_COMMENT);
+        if (*p == '\0' || p[1] == '/') return p;
+        p++; // a '*' that does not close the comment
+    }
+}
+
+static SCAN_NOSAN const char* sse2_word(const char* p) {
+    return sse2_run(p, RUN_WORD);
+}
+
+static SCAN_NOSAN const char* sse2_digits(const char* p) {
+    return sse2_run(p, RUN_DIGITS);
+}
+
+// ASCII blocks are skipped 16 bytes at a time, the rest is decoded
+static int sse2_utf8_valid(const char* p, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        if (n - i >= 16) {
+            uint32_t high = (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p + i)));
+            if (!high) {
+                i += 16;
+                continue;
+            }
+            i += (size_t)__builtin_ctz(high);
+        } else if ((unsigned char)p[i] < 0x80) {
+            i++;
+            continue;
+        }
+        if (!(i = utf8_run(p, i, n))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static const ScanKernels sse2_kernels = {
+    "sse2", sse2_whitespace, sse2_line_comment, sse2_block_comment,
+    sse2_word, sse2_digits, sse2_utf8_valid
+};
+
+/* AVX2 kernels (32 bytes per step), same structure as the SSE2 ones */
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+SCAN_INLINE SCAN_NOSAN AVX2_TARGET __m256i avx2_in_range(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8((char)(lo - 1))),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(hi + 1)), v));
+}
+
+SCAN_INLINE SCAN_NOSAN AVX2_TARGET uint32_t avx2_stop_mask(__m256i v, int kind) {
+    __m256i newline = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+    __m256i stop;
+
+    switch (kind) {
+        case RUN_WHITESPACE: {
+            __m256i ws = _mm256_or_si256(newline,
+                         _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                         _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))));
+            return ~(uint32_t)_mm256_movemask_epi8(ws);
+        }
+        case RUN_LINE_COMMENT:
+            stop = _mm256_or_si256(newline, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+            return (uint32_t)_mm256_movemask_epi8(stop);
+        case RUN_BLOCK_COMMENT:
+            stop = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')),
+                                   _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+            return (uint32_t)_mm256_movemask_epi8(stop);
+        case RUN_WORD: {
+            __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+            __m256i word = _mm256_or_si256(avx2_in_range(v, '0', '9'),
+                           _mm256_or_si256(avx2_in_range(lower, 'a', 'z'),
+                                           _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'))));
+            return ~(uint32_t)_mm256_movemask_epi8(word);
+        }
+        default: // RUN_DIGITS
+            return ~(uint32_t)_mm256_movemask_epi8(avx2_in_range(v, '0', '9'));
+    }
+}
+
+SCAN_INLINE SCAN_NOSAN AVX2_TARGET const char* avx2_run(const char* p, int kind) {
+    uintptr_t skew = (uintptr_t)p & 31;
+    const char* block = p - skew;
+    uint32_t keep = 0xFFFFFFFFu << skew;
+
+    for (;;) {
+        uint32_t stop = avx2_stop_mask(_mm256_load_si256((const __m256i*)block), kind) & keep;
+        if (stop) {
+            return block + __builtin_ctz(stop);
+        }
+        block += 32;
+        keep = 0xFFFFFFFFu;
+    }
+}
+
+static SCAN_NOSAN AVX2_TARGET const char* avx2_whitespace(const char* p) {
+    return avx2_run(p, RUN_WHITESPACE);
+}
+
+static SCAN_NOSAN AVX2_TARGET const char* avx2_line_comment(const char* p) {
+    return avx2_run(p, RUN_LINE_COMMENT);
+}
+
+static SCAN_NOSAN AVX2_TARGET const char* avx2_block_comment(const char* p) {
+    for (;;) {
+        p = avx2_run(p, RUN_BLOCK_COMMENT);
+        if (*p == '\0' || p[1] == '/') return p;
+        p++;
+    }
+}
+
+static SCAN_NOSAN AVX2_TARGET const char* avx2_word(const char* p) {
+    return avx2_run(p, RUN_WORD);
+}
+
+static SCAN_NOSAN AVX2_TARGET const char* avx2_digits(const char* p) {
+    return avx2_run(p, RUN_DIGITS);
+}
+
+/* UTF-8 validation without decoding (Keiser and Lemire, "Validating UTF-8 In
+ * Less Than One Instruction Per Byte", 2021). Every error shows up in a pair
+ * of adjacent bytes, except for a missing or extra continuation byte of a 3-
+ * or 4-byte character. Three table lookups, on the high and low nibble of the
+ * first byte and the high nibble of the second, each return the set of errors
+ * the pair could be part of; a bit that survives the AND of all three is an
+ * error. Continuation bytes in the 3rd/4th position of a character are checked
+ * separately against the lead byte two and three back.
+ */
+enum {
+    U8_TOO_SHORT = 1 << 0,      // lead byte followed by a lead byte or ASCII
+    U8_TOO_LONG = 1 << 1,       // ASCII followed by a continuation byte
+    U8_OVERLONG_3 = 1 << 2,     // E0 80..9F
+    U8_TOO_LARGE = 1 << 3,      // F4 90..BF, F5..FF 90..BF
+    U8_SURROGATE = 1 << 4,      // ED A0..BF
+    U8_OVERLONG_2 = 1 << 5,     // C0, C1
+    U8_TOO_LARGE_1000 = 1 << 6, // F5..FF 80..8F
+    U8_OVERLONG_4 = 1 << 6,     // F0 80..8F
+    U8_TWO_CONTS = 1 << 7,      // two continuation bytes (checked below)
+    U8_CARRY = U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS,
+};
+
+// A 16-entry table in both lanes, for _mm256_shuffle_epi8
+#define U8_TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+SCAN_INLINE AVX2_TARGET __m256i avx2_high_nibbles(__m256i v) {
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+// Bytes of the previous and the current block shifted by n (1 to 3): lane i
+// gets byte i - n of the 64 bytes prev:input
+#define AVX2_PREV(input, prev, n) \
+    _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - (n))
+
+SCAN_INLINE AVX2_TARGET __m256i avx2_utf8_errors(__m256i input, __m256i prev) {
+    __m256i prev1 = AVX2_PREV(input, prev, 1);
+
+    __m256i byte_1_high = _mm256_shuffle_epi8(U8_TABLE(
+        // 0xxx: ASCII
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        // 10xx: continuation
+        U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+        // 1100, 1101: 2-byte lead
+        U8_TOO_SHORT | U8_OVERLONG_2,
+        U8_TOO_SHORT,
+        // 1110: 3-byte lead
+        U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+        // 1111: 4-byte lead
+        U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4),
+        avx2_high_nibbles(prev1));
+
+    __m256i byte_1_low = _mm256_shuffle_epi8(U8_TABLE(
+        U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,   // xxxx0000
+        U8_CARRY | U8_OVERLONG_2,                                   // xxxx0001
+        U8_CARRY,
+        U8_CARRY,
+        U8_CARRY | U8_TOO_LARGE,                                    // xxxx0100
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE, // xxxx1101
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),
+        _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)));
+
+    __m256i byte_2_high = _mm256_shuffle_epi8(U8_TABLE(
+        // 0xxx: ASCII
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        // 1000, 1001, 101x: continuation
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+        // 11xx: lead
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT),
+        avx2_high_nibbles(input));
+
+    __m256i special = _mm256_and_si256(byte_1_high, _mm256_and_si256(byte_1_low, byte_2_high));
+
+    // a byte two after a 3- or 4-byte lead, or three after a 4-byte lead, must
+    // be a continuation byte: exactly those pairs have TWO_CONTS set above
+    __m256i third = _mm256_subs_epu8(AVX2_PREV(input, prev, 2), _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(AVX2_PREV(input, prev, 3), _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must_continue, special);
+}
+
+// Non-zero bytes where the block ends inside a character
+SCAN_INLINE AVX2_TARGET __m256i avx2_utf8_incomplete(__m256i input) {
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    return _mm256_subs_epu8(input, max);
+}
+
+static AVX2_TARGET int avx2_utf8_valid(const char* p, size_t n) {
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (;;) {
+        __m256i input;
+        if (n - i >= 32) {
+            input = _mm256_loadu_si256((const __m256i*)(p + i));
+        } else {
+            // the tail, padded with '\0' (which is ASCII and so ends a
+            // character that is still incomplete with an error)
+            char tail[32] = {0};
+            memcpy(tail, p + i, n - i);
+            input = _mm256_loadu_si256((const __m256i*)tail);
+        }
+
+        if (!_mm256_movemask_epi8(input)) {
+            // all ASCII: only a character left open by the last block can be
+            // wrong
+            error = _mm256_or_si256(error, incomplete);
+            incomplete = _mm256_setzero_si256();
+        } else {
+            error = _mm256_or_si256(error, avx2_utf8_errors(input, prev));
+            incomplete = avx2_utf8_incomplete(input);
+        }
+        prev = input;
+
+        if (n - i <= 32) {
+            break;
+        }
+        i += 32;
+    }
+    error = _mm256_or_si256(error, incomplete);
+    return _mm256_testz_si256(error, error);
+}
+
+static const ScanKernels avx2_kernels = {
+    "avx2", avx2_whitespace, avx2_line_comment, avx2_block_comment,
+    avx2_word, avx2_digits, avx2_utf8_valid
+};
+
+#endif /* SCAN_X86 */
+
+/* Dispatch
+ * The scan_* entry points are function pointers so the lexer reaches a kernel
+ * with a single indirect call. They start out pointing at resolvers that pick
+ * the best kernel set on first use and then forward the call.
+ */
+
+static const ScanKernels* best_kernels(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &avx2_kernels;
+    }
+    return &sse2_kernels; // SSE2 is part of x86-64
+#else
+    return &scalar_kernels;
+#endif
+}
+
+static const char* resolve_whitespace(const char* p);
+static const char* resolve_line_comment(const char* p);
+static const char* resolve_block_comment(const char* p);
+static const char* resolve_word(const char* p);
+static const char* resolve_digits(const char* p);
+static int resolve_utf8_valid(const char* p, size_t n);
+
+static const ScanKernels* kernels = NULL;
+
+const char* (*scan_whitespace)(const char* p) = resolve_whitespace;
+const char* (*scan_line_comment)(const char* p) = resolve_line_comment;
+const char* (*scan_block_comment)(const char* p) = resolve_block_comment;
+const char* (*scan_word)(const char* p) = resolve_word;
+const char* (*scan_digits)(const char* p) = resolve_digits;
+int (*scan_utf8_valid)(const char* p, size_t n) = resolve_utf8_valid;
+
+static void use_kernels(const ScanKernels* set) {
+    kernels = set;
+    scan_whitespace = set->whitespace;
+    scan_line_comment = set->line_comment;
+    scan_block_comment = set->block_comment;
+    scan_word = set->word;
+    scan_digits = set->digits;
+    scan_utf8_valid = set->utf8_valid;
+}
+
+static const char* resolve_whitespace(const char* p) {
+    use_kernels(best_kernels());
+    return scan_whitespace(p);
+}
+
+static const char* resolve_line_comment(const char* p) {
+    use_kernels(best_kernels());
+    return scan_line_comment(p);
+}
+
+static const char* resolve_block_comment(const char* p) {
+    use_kernels(best_kernels());
+    return scan_block_comment(p);
+}
+
+static const char* resolve_word(const char* p) {
+    use_kernels(best_kernels());
+    return scan_word(p);
+}
+
+static const char* resolve_digits(const char* p) {
+    use_kernels(best_kernels());
+    return scan_digits(p);
+}
+
+static int resolve_utf8_valid(const char* p, size_t n) {
+    use_kernels(best_kernels());
+    return scan_utf8_valid(p, n);
+}
+
+int scan_select(const char* name) {
+    if (strcmp(name, "scalar") == 0) {
+        use_kernels(&scalar_kernels);
+        return 1;
+    }
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0) {
+        use_kernels(&sse2_kernels);
+        return 1;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        use_kernels(&avx2_kernels);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+const char* scan_kernel_name(void) {
+    if (!kernels) {
+        use_kernels(best_kernels());
+    }
+    return kernels->name;
+}
@@ -0,0 +1,92 @@
+/* tokenbuf.c - whole-file token buffer */
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/lexer.h"
+
+void token_buffer_init(TokenBuffer *buffer, const char *source) {
+    memset(buffer, 0, sizeof(TokenBuffer));
+    buffer->source = source;
+}
+
+// Make room for at least need tokens
+int token_buffer_reserve(TokenBuffer *buffer, size_t need) {
+    if (need <= buffer->cap) {
+        return 1;
+    }
+    size_t cap = buffer->cap ? buffer->cap : 256;
+    while (cap < need) cap *= 2;
+
+    uint16_t *type = realloc(buffer->type, cap * sizeof(uint16_t));
+    if (!type) return 0;
+    buffer->type = type;
+    uint16_t *error = realloc(buffer->error, cap * sizeof(uint16_t));
+    if (!error) return 0;
+    buffer->error = error;
+    uint32_t *offset = realloc(buffer->offset, cap * sizeof(uint32_t));
+    if (!offset) return 0;
+    buffer->offset = offset;
+    uint32_t *length = realloc(buffer->length, cap * sizeof(uint32_t));
+    if (!length) return 0;
+    buffer->length = length;
+
+    buffer->cap = cap;
+    return 1;
+}
+
+// Store token at index i (room must have been reserved)
+static void put(TokenBuffer *buffer, size_t i, const Token *token) {
+    buffer->type[i] = token->type;
+    buffer->error[i] = token->error;
+    buffer->offset[i] = token->offset;
+    buffer->length[i] = token->length;
+}
+
+int token_buffer_append(TokenBuffer *buffer, const Token *tokens, size_t count) {
+    if (!token_buffer_reserve(buffer, buffer->count + count)) {
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        put(buffer, buffer->count + i, &tokens[i]);
+    }
+    buffer->count += count;
+    return 1;
+}
+
+int token_buffer_lex(TokenBuffer *buffer, const char *source, size_t size) {
+    Lexer lexer;
+    Token token;
+
+    token_buffer_init(buffer, source);
+    lexer_init(&lexer, source);
+
+    // about one token per 4 bytes of source, grown if need be
+    if (!token_buffer_reserve(buffer, size / 4 + 16)) {
+        return 0;
+    }
+    do {
+        token = lexer_next_token(&lexer);
+        if (buffer->count == buffer->cap && !token_buffer_reserve(buffer, buffer->count + 1)) {
+            return 0;
+        }
+        put(buffer, buffer->count++, &token);
+    } while (token.type != TOKEN_EOF);
+    buffer->errors = lexer.errors;
+    return 1;
+}
+
+Token token_buffer_get(const TokenBuffer *buffer, size_t i) {
+    if (i >= buffer->count) {
+        i = buffer->count - 1; // stay on TOKEN_EOF
+    }
+    Token token = {.offset = buffer->offset[i], .length = buffer->length[i],
+                   .type = buffer->type[i], .error = buffer->error[i]};
+    return token;
+}
+
+void token_buffer_free(TokenBuffer *buffer) {
+    free(buffer->type);
+    free(buffer->error);
+    free(buffer->offset);
+    free(buffer->length);
+    token_buffer_init(buffer, NULL);
+}
@@ -0,0 +1,115 @@
+/* utf8.c - UTF-8 decoding and identifier characters */
+#include "../../include/utf8.h"
+
+int utf8_feed(Utf8Stream *s, unsigned char byte) {
+    if (s->need > 0) {
+        if (byte < s->lo || byte > s->hi) {
+            return 0;
+        }
+        s->need--;
+        s->lo = 0x80;
+        s->hi = 0xBF;
+        return 1;
+    }
+    if (byte < 0x80) {
+        return 1;
+    }
+    // lead byte: how many continuation bytes follow, and the range of the
+    // first one (which rules out overlong forms, surrogates and > U+10FFFF)
+    if (byte >= 0xC2 && byte <= 0xDF) {
+        s->need = 1;
+    } else if (byte >= 0xE0 && byte <= 0xEF) {
+        s->need = 2;
+        if (byte == 0xE0) s->lo = 0xA0;
+        if (byte == 0xED) s->hi = 0x9F;
+    } else if (byte >= 0xF0 && byte <= 0xF4) {
+        s->need = 3;
+        if (byte == 0xF0) s->lo = 0x90;
+        if (byte == 0xF4) s->hi = 0x8F;
+    } else {
+        return 0; // continuation byte without a lead, C0, C1 or F5-FF
+    }
+    return 1;
+}
+
+int utf8_decode(const char *p, size_t avail, uint32_t *cp) {
+    const unsigned char *s = (const unsigned char *)p;
+    Utf8Stream state = UTF8_STREAM_INIT;
+
+    if (avail == 0 || !utf8_feed(&state, s[0])) {
+        return 0;
+    }
+    int length = 1 + state.need;
+    if ((size_t)length > avail) {
+        return 0;
+    }
+    // the lead byte keeps 7, 5, 4 or 3 bits
+    uint32_t value = s[0] & (0x7F >> state.need >> (state.need > 0));
+    for (int i = 1; i < length; i++) {
+        if (!utf8_feed(&state, s[i])) {
+            return 0; // also stops at a '\0', which is no continuation byte
+        }
+        value = (value << 6) | (s[i] & 0x3F);
+    }
+    *cp = value;
+    return length;
+}
+
+/* Ranges of characters allowed in identifiers, C11 Annex D.1, and those not
+ * allowed at the start of one (combining marks), Annex D.2. ASCII is handled
+ * by the lexer itself.
+ */
+typedef struct {
+    uint32_t first, last;
+} Range;
+
+static const Range identifier_ranges[] = {
+    {0x00A8, 0x00A8}, {0x00AA, 0x00AA}, {0x00AD, 0x00AD}, {0x00AF, 0x00AF},
+    {0x00B2, 0x00B5}, {0x00B7, 0x00BA}, {0x00BC, 0x00BE}, {0x00C0, 0x00D6},
+    {0x00D8, 0x00F6}, {0x00F8, 0x00FF}, {0x0100, 0x167F}, {0x1681, 0x180D},
+    {0x180F, 0x1FFF}, {0x200B, 0x200D}, {0x202A, 0x202E}, {0x203F, 0x2040},
+    {0x2054, 0x2054}, {0x2060, 0x206F}, {0x2070, 0x218F}, {0x2460, 0x24FF},
+    {0x2776, 0x2793}, {0x2C00, 0x2DFF}, {0x2E80, 0x2FFF}, {0x3004, 0x3007},
+    {0x3021, 0x302F}, {0x3031, 0x303F}, {0x3040, 0xD7FF}, {0xF900, 0xFD3D},
+    {0xFD40, 0xFDCF}, {0xFDF0, 0xFE44}, {0xFE47, 0xFFFD},
+    // every plane from 1 to 14 except its last two code points
+    {0x10000, 0x1FFFD}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}, {0x40000, 0x4FFFD},
+    {0x50000, 0x5FFFD}, {0x60000, 0x6FFFD}, {0x70000, 0x7FFFD}, {0x80000, 0x8FFFD},
+    {0x90000, 0x9FFFD}, {0xA0000, 0xAFFFD}, {0xB0000, 0xBFFFD}, {0xC0000, 0xCFFFD},
+    {0xD0000, 0xDFFFD}, {0xE0000, 0xEFFFD},
+};
+
+static const Range combining_ranges[] = {
+    {0x0300, 0x036F}, {0x1DC0, 0x1DFF}, {0x20D0, 0x20FF}, {0xFE20, 0xFE2F},
+};
+
+static int in_ranges(uint32_t cp, const Range *ranges, size_t count) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cp < ranges[mid].first) {
+            hi = mid;
+        } else if (cp > ranges[mid].last) {
+            lo = mid + 1;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int utf8_identifier_char(const char *p, int first) {
+    uint32_t cp;
+    int length = utf8_decode(p, 4, &cp); // stops at a '\0', see utf8_decode
+    if (length < 2) {
+        return 0;
+    }
+    if (!in_ranges(cp, identifier_ranges, sizeof(identifier_ranges) / sizeof(Range))) {
+        return 0;
+    }
+    if (first && in_ranges(cp, combining_ranges, sizeof(combining_ranges) / sizeof(Range))) {
+        return 0;
+    }
+    return length;
+}
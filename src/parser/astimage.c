@@ -0,0 +1,254 @@
+/* astimage.c - AST images that are mapped instead of parsed */
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../include/astimage.h"
+#include "../../include/intern.h"
+
+#define IMAGE_MAGIC "ASTIMAGE"
+#define IMAGE_VERSION 2         // bump when the layout or the node kinds change
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+enum {
+    SECTION_KIND, SECTION_CHILD, SECTION_SIBLING, SECTION_TOKEN, SECTION_NAME,
+    SECTION_TYPE, SECTION_ERROR, SECTION_OFFSET, SECTION_LENGTH,
+    SECTION_NAME_START, SECTION_CHARS,
+    SECTIONS
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t key;               // ast_image_key of the source
+    uint64_t source_size;
+    uint64_t nodes;
+    uint64_t tokens;
+    uint64_t names;
+    int64_t errors;             // AST errors
+    uint64_t offset[SECTIONS];  // of each section from the start of the file
+    uint64_t length[SECTIONS];  // in bytes
+} ImageHeader;
+
+// FNV-1a over 64-bit words, with a shift to move the high bits down
+uint64_t ast_image_key(const char* source, size_t size) {
+    uint64_t hash = 14695981039346656037ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, source + i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ (unsigned char)source[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/* Writing */
+
+// Append a section of length bytes to out, padded to 8 bytes
+static int write_section(FILE* out, ImageHeader* header, int section, uint64_t* at,
+                         const void* data, size_t length) {
+    static const char padding[8];
+    header->offset[section] = *at;
+    header->length[section] = length;
+    size_t pad = (8 - length % 8) % 8;
+    if (length && fwrite(data, 1, length, out) != length) return 0;
+    if (pad && fwrite(padding, 1, pad, out) != pad) return 0;
+    *at += length + pad;
+    return 1;
+}
+
+static int write_image(FILE* out, const AST* ast, ImageHeader* header) {
+    const TokenBuffer* tokens = ast->tokens;
+    size_t nodes = ast->count;
+    size_t count = tokens->count;
+    uint64_t at = sizeof(ImageHeader);
+
+    // the header goes first, once the sections are in place
+    if (fseek(out, (long)at, SEEK_SET) != 0) return 0;
+
+    if (!write_section(out, header, SECTION_KIND, &at, ast->kind, nodes * sizeof(uint8_t)) ||
+        !write_section(out, header, SECTION_CHILD, &at, ast->child, nodes * sizeof(NodeId)) ||
+        !write_section(out, header, SECTION_SIBLING, &at, ast->sibling, nodes * sizeof(NodeId)) ||
+        !write_section(out, header, SECTION_TOKEN, &at, ast->token, nodes * sizeof(uint32_t)) ||
+        !write_section(out, header, SECTION_NAME, &at, ast->name, nodes * sizeof(int)) ||
+        !write_section(out, header, SECTION_TYPE, &at, tokens->type, count * sizeof(uint16_t)) ||
+        !write_section(out, header, SECTION_ERROR, &at, tokens->error, count * sizeof(uint16_t)) ||
+        !write_section(out, header, SECTION_OFFSET, &at, tokens->offset, count * sizeof(uint32_t)) ||
+        !write_section(out, header, SECTION_LENGTH, &at, tokens->length, count * sizeof(uint32_t))) {
+        return 0;
+    }
+
+    // every interned name, in id order
+    int names = intern_count();
+    uint32_t* start = malloc((names + 1) * sizeof(uint32_t));
+    if (!start) return 0;
+    size_t chars = 0;
+    for (int id = 0; id < names; id++) {
+        start[id] = (uint32_t)chars;
+        chars += intern_length(id) + 1;
+    }
+    start[names] = (uint32_t)chars;
+    int ok = write_section(out, header, SECTION_NAME_START, &at, start, (names + 1) * sizeof(uint32_t));
+    free(start);
+    if (!ok) return 0;
+
+    header->offset[SECTION_CHARS] = at;
+    header->length[SECTION_CHARS] = chars;
+    for (int id = 0; id < names; id++) {
+        if (fwrite(intern_name(id), 1, intern_length(id) + 1, out) != intern_length(id) + 1) {
+            return 0;
+        }
+    }
+
+    header->names = (uint64_t)names;
+    return fseek(out, 0, SEEK_SET) == 0 && fwrite(header, sizeof(ImageHeader), 1, out) == 1;
+}
+
+int ast_image_save(const char* path, const AST* ast, uint64_t key, size_t source_size) {
+    for (size_t i = 0; i < ast->count; i++) {
+        if (ast->kind[i] == AST_LAZY_BLOCK) {
+            return 0; // the loaded nodes cannot be parsed any further
+        }
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.key = key;
+    header.source_size = source_size;
+    header.nodes = ast->count;
+    header.tokens = ast->tokens->count;
+    header.errors = ast->errors;
+
+    // written under another name and renamed, so a reader never maps half
+    // an image
+    size_t length = strlen(path);
+    char* temp = malloc(length + 32);
+    if (!temp) return 0;
+    snprintf(temp, length + 32, "%s.%ld.tmp", path, (long)getpid());
+    FILE* out = fopen(temp, "wb");
+    if (!out) {
+        free(temp);
+        return 0;
+    }
+    int ok = write_image(out, ast, &header);
+    ok &= fclose(out) == 0;
+    ok = ok && rename(temp, path) == 0;
+    if (!ok) {
+        remove(temp);
+    }
+    free(temp);
+    return ok;
+}
+
+/* Loading */
+
+// Check that the header belongs to source and its sections lie in the file
+static int check_header(const ImageHeader* header, size_t file_size, uint64_t key, size_t size) {
+    static const size_t element[SECTIONS] = {
+        sizeof(uint8_t), sizeof(NodeId), sizeof(NodeId), sizeof(uint32_t), sizeof(int),
+        sizeof(uint16_t), sizeof(uint16_t), sizeof(uint32_t), sizeof(uint32_t),
+        sizeof(uint32_t), 1,
+    };
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != IMAGE_VERSION || header->byte_order != IMAGE_BYTE_ORDER ||
+        header->source_size != size || header->key != key ||
+        header->nodes == 0 || header->tokens == 0) {
+        return 0;
+    }
+    for (int i = 0; i < SECTIONS; i++) {
+        uint64_t count = i <= SECTION_NAME ? header->nodes
+                       : i <= SECTION_LENGTH ? header->tokens
+                       : i == SECTION_NAME_START ? header->names + 1
+                       : header->length[i];
+        if (header->offset[i] % 8 != 0 || header->length[i] != count * element[i] ||
+            header->offset[i] > file_size || header->length[i] > file_size - header->offset[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Intern the image's names into the empty pool, so they get their old ids
+static int restore_names(const ImageHeader* header, const char* base) {
+    if (intern_count() != 0) {
+        return 0;
+    }
+    const uint32_t* start = (const uint32_t*)(base + header->offset[SECTION_NAME_START]);
+    const char* chars = base + header->offset[SECTION_CHARS];
+    for (uint64_t id = 0; id < header->names; id++) {
+        if (start[id] >= start[id + 1] || start[id + 1] > header->length[SECTION_CHARS] ||
+            intern(chars + start[id], start[id + 1] - start[id] - 1) != (int)id) {
+            intern_free();
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int ast_image_load(AstImage* image, const char* path, uint64_t key, const char* source, size_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ImageHeader)) {
+        close(fd);
+        return 0;
+    }
+    size_t file_size = (size_t)st.st_size;
+    void* map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    const char* base = map;
+    const ImageHeader* header = map;
+    if (!check_header(header, file_size, key, size) || !restore_names(header, base)) {
+        munmap(map, file_size);
+        return 0;
+    }
+
+    TokenBuffer* tokens = &image->tokens;
+    tokens->source = source;
+    tokens->type = (uint16_t*)(base + header->offset[SECTION_TYPE]);
+    tokens->error = (uint16_t*)(base + header->offset[SECTION_ERROR]);
+    tokens->offset = (uint32_t*)(base + header->offset[SECTION_OFFSET]);
+    tokens->length = (uint32_t*)(base + header->offset[SECTION_LENGTH]);
+    tokens->count = header->tokens;
+    tokens->cap = 0;
+    tokens->errors = 0;
+
+    AST* ast = &image->ast;
+    ast->kind = (uint8_t*)(base + header->offset[SECTION_KIND]);
+    ast->child = (NodeId*)(base + header->offset[SECTION_CHILD]);
+    ast->sibling = (NodeId*)(base + header->offset[SECTION_SIBLING]);
+    ast->token = (uint32_t*)(base + header->offset[SECTION_TOKEN]);
+    ast->name = (int*)(base + header->offset[SECTION_NAME]);
+    ast->count = header->nodes;
+    ast->cap = 0;
+    ast->errors = (int)header->errors;
+    ast->sharing = 0; // an image has no LazyBlocks to parse
+    ast->shared = NULL;
+    ast->shared_cap = 0;
+    ast->shared_count = 0;
+    ast->tokens = tokens;
+
+    image->map = map;
+    image->map_size = file_size;
+    return 1;
+}
+
+void ast_image_close(AstImage* image) {
+    munmap(image->map, image->map_size);
+    image->map = NULL;
+    image->map_size = 0;
+}
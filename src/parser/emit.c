@@ -0,0 +1,312 @@
+/* emit.c - writing ASTs as text, JSON or Graphviz DOT */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../include/emit.h"
+
+#define OUTPUT_BLOCK (64 * 1024)    // bytes collected before a write
+
+/* Output */
+
+void output_init(Output *out, int fd) {
+    memset(out, 0, sizeof(Output));
+    out->fd = fd;
+}
+
+int output_flush(Output *out) {
+    size_t done = 0;
+    while (done < out->length && !out->failed) {
+        ssize_t n = write(out->fd, out->data + done, out->length - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            out->failed = 1;
+        } else {
+            done += (size_t)n;
+        }
+    }
+    out->length = 0;
+    return !out->failed;
+}
+
+void output_free(Output *out) {
+    output_flush(out);
+    free(out->data);
+    out->data = NULL;
+    out->cap = 0;
+}
+
+// Make room for length more bytes, writing out what is there if need be
+static int output_reserve(Output *out, size_t length) {
+    if (out->length + length <= out->cap) {
+        return 1;
+    }
+    if (out->length > 0 && !output_flush(out)) {
+        return 0;
+    }
+    if (length > out->cap) {
+        size_t cap = length > OUTPUT_BLOCK ? length : OUTPUT_BLOCK;
+        char *grown = realloc(out->data, cap);
+        if (!grown) {
+            out->failed = 1;
+            return 0;
+        }
+        out->data = grown;
+        out->cap = cap;
+    }
+    return 1;
+}
+
+void output_write(Output *out, const char *text, size_t length) {
+    if (length == 0) {
+        return; // data may still be NULL
+    }
+    if (output_reserve(out, length)) {
+        memcpy(out->data + out->length, text, length);
+        out->length += length;
+    }
+}
+
+void output_string(Output *out, const char *text) {
+    output_write(out, text, strlen(text));
+}
+
+void output_char(Output *out, char c) {
+    if (output_reserve(out, 1)) {
+        out->data[out->length++] = c;
+    }
+}
+
+void output_spaces(Output *out, size_t count) {
+    if (count == 0) {
+        return; // data may still be NULL
+    }
+    if (output_reserve(out, count)) {
+        memset(out->data + out->length, ' ', count);
+        out->length += count;
+    }
+}
+
+void output_number(Output *out, unsigned long number) {
+    char digits[24];
+    size_t i = sizeof(digits);
+    do {
+        digits[--i] = (char)('0' + number % 10);
+        number /= 10;
+    } while (number > 0);
+    output_write(out, digits + i, sizeof(digits) - i);
+}
+
+/* Node labels */
+
+static const struct {
+    const char *label;  // in the outline
+    const char *name;   // in JSON and DOT
+    int lexeme;         // followed by the text of the node's token
+} kinds[] = {
+    [AST_PROGRAM]      = {"Program", "Program", 0},
+    [AST_VARDECL]      = {"VarDecl", "VarDecl", 1},
+    [AST_ASSIGN]       = {"Assign", "Assign", 0},
+    [AST_PRINT]        = {"Print", "Print", 0},
+    [AST_NUMBER]       = {"Number", "Number", 1},
+    [AST_IDENTIFIER]   = {"Identifier", "Identifier", 1},
+    [AST_IF]           = {"IfStatement", "If", 1},
+    [AST_WHILE]        = {"WhileLoop", "While", 1},
+    [AST_REPEAT]       = {"Repeat", "Repeat", 1},
+    [AST_BLOCK]        = {"Block", "Block", 0},
+    [AST_FUNCTIONCALL] = {"FunctionCall", "FunctionCall", 1},
+    [AST_BINOP]        = {"BinaryOp", "BinaryOp", 1},
+    [AST_COMP]         = {"Comparison", "Comparison", 1},
+    [AST_OPERATOR]     = {"Operator", "Operator", 1},
+    [AST_ERROR]        = {"Error", "Error", 1},
+    [AST_LAZY_BLOCK]   = {"Block: not parsed", "LazyBlock", 0}, // only if there was no memory to parse it
+    [AST_REF]          = {"Ref", "Ref", 0},
+};
+
+#define KNOWN(kind) ((kind) < sizeof(kinds) / sizeof(kinds[0]) && kinds[kind].label)
+
+// Text of the token of node
+static const char *node_text(const AST *ast, NodeId node, size_t *length) {
+    Token token = ast_token(ast, node);
+    *length = token.length;
+    return TOKEN_TEXT(parser_source(), token);
+}
+
+// Append text as the inside of a JSON or DOT string
+static void output_quoted(Output *out, const char *text, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') {
+            output_char(out, '\\');
+            output_char(out, (char)c);
+        } else if (c == '\n') {
+            output_write(out, "\\n", 2);
+        } else if (c < 0x20) {
+            char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+            output_write(out, escape, sizeof(escape));
+        } else {
+            output_char(out, (char)c);
+        }
+    }
+}
+
+/* Text: the outline print_ast has always printed */
+
+static void text_enter(Output *out, const AST *ast, const AstVisit *visit) {
+    uint8_t kind = ast->kind[visit->node];
+    output_spaces(out, 2 * ((size_t)out->level + visit->depth));
+    if (!KNOWN(kind)) {
+        output_string(out, "Unknown node type\n");
+        return;
+    }
+    output_string(out, kinds[kind].label);
+    if (kinds[kind].lexeme) {
+        size_t length;
+        const char *text = node_text(ast, visit->node, &length);
+        output_write(out, ": ", 2);
+        output_write(out, text, length);
+    }
+    output_char(out, '\n');
+}
+
+const Emitter emit_text = {AST_WALK_REFS, NULL, text_enter, NULL, NULL};
+
+/* JSON: a node is {"kind", "text" (if it has a lexeme), "line", "column",
+ * "children"} */
+
+static void json_enter(Output *out, const AST *ast, const AstVisit *visit) {
+    uint8_t kind = ast->kind[visit->node];
+    if (out->comma) {
+        output_char(out, ',');
+    }
+    output_string(out, "{\"kind\":\"");
+    output_string(out, KNOWN(kind) ? kinds[kind].name : "Unknown");
+    output_char(out, '"');
+    Token token = ast_token(ast, visit->node);
+    if (KNOWN(kind) && kinds[kind].lexeme) {
+        output_string(out, ",\"text\":\"");
+        output_quoted(out, TOKEN_TEXT(parser_source(), token), token.length);
+        output_char(out, '"');
+    }
+    SourceLocation where = parser_locate(&token);
+    output_string(out, ",\"line\":");
+    output_number(out, (unsigned long)where.line);
+    output_string(out, ",\"column\":");
+    output_number(out, (unsigned long)where.column);
+    output_string(out, ",\"children\":[");
+    out->comma = 0;
+}
+
+static void json_leave(Output *out, const AST *ast, const AstVisit *visit) {
+    (void)ast;
+    (void)visit;
+    output_write(out, "]}", 2);
+    out->comma = 1;
+}
+
+static void json_end(Output *out) {
+    output_char(out, '\n');
+}
+
+const Emitter emit_json = {AST_WALK_REFS, NULL, json_enter, json_leave, json_end};
+
+/* DOT: a box per node, named n<NodeId>, and an arrow to each child. A Ref is
+ * drawn as a dashed arrow to the expression it repeats, so shared
+ * expressions show up as such. */
+
+static void dot_begin(Output *out) {
+    output_string(out, "digraph AST {\n  node [shape=box];\n");
+}
+
+static void dot_node_name(Output *out, NodeId node) {
+    output_char(out, 'n');
+    output_number(out, node);
+}
+
+static void dot_enter(Output *out, const AST *ast, const AstVisit *visit) {
+    NodeId node = visit->node;
+    uint8_t kind = ast->kind[node];
+    if (kind == AST_REF) {
+        output_spaces(out, 2);
+        dot_node_name(out, visit->parent);
+        output_string(out, " -> ");
+        dot_node_name(out, ast->child[node]);
+        output_string(out, " [style=dashed];\n");
+        return;
+    }
+
+    output_spaces(out, 2);
+    dot_node_name(out, node);
+    output_string(out, " [label=\"");
+    output_string(out, KNOWN(kind) ? kinds[kind].name : "Unknown");
+    if (KNOWN(kind) && kinds[kind].lexeme) {
+        size_t length;
+        const char *text = node_text(ast, node, &length);
+        output_write(out, ": ", 2);
+        output_quoted(out, text, length);
+    }
+    output_string(out, "\"];\n");
+    if (visit->depth > 0) {
+        output_spaces(out, 2);
+        dot_node_name(out, visit->parent);
+        output_string(out, " -> ");
+        dot_node_name(out, node);
+        output_string(out, ";\n");
+    }
+}
+
+static void dot_end(Output *out) {
+    output_string(out, "}\n");
+}
+
+const Emitter emit_dot = {0, dot_begin, dot_enter, NULL, dot_end};
+
+/* Walking */
+
+int ast_emit(AST *ast, NodeId root, const Emitter *emitter, Output *out) {
+    AstWalk walk;
+    AstVisit visit;
+
+    ast_walk_init(&walk, ast, root, emitter->walk_flags);
+    if (emitter->begin) {
+        emitter->begin(out);
+    }
+    while (ast_walk_next(&walk, &visit)) {
+        if (visit.event == AST_ENTER) {
+            if (ast->kind[visit.node] == AST_LAZY_BLOCK) {
+                // parse it before the walk looks for its children; the parser
+                // prints its errors through stdio, which has to keep in step
+                output_flush(out);
+                ast_expand(ast, visit.node);
+                fflush(stdout);
+            }
+            if (emitter->enter) {
+                emitter->enter(out, ast, &visit);
+            }
+        } else if (emitter->leave) {
+            emitter->leave(out, ast, &visit);
+        }
+    }
+    if (emitter->end) {
+        emitter->end(out);
+    }
+    int ok = !walk.out_of_memory && !out->failed;
+    ast_walk_free(&walk);
+    return ok;
+}
+
+// Print AST (for debugging): node and its children, level deep; a Ref is
+// printed like the copy it replaced
+void print_ast(AST *tree, NodeId node, int level) {
+    Output out;
+    output_init(&out, STDOUT_FILENO);
+    out.level = level;
+    fflush(stdout); // what was printed before goes first
+    int ok = ast_emit(tree, node, &emit_text, &out);
+    output_free(&out);
+    if (!ok || out.failed) {
+        fprintf(stderr, "Cannot print the AST\n");
+    }
+}
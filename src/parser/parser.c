@@ -1,10 +1,12 @@
 /* parser.c */
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "../../include/parser.h"
 #include "../../include/lexer.h"
 #include "../../include/tokens.h"
-#include <string.h> // for strcmp
+#include "../../include/intern.h"
+#include <string.h> // for memcmp
 
 // TODO 1: Add more parsing function declarations for:
 // - if statements: if (condition) { ... }
@@ -14,22 +16,38 @@
 // - blocks: { statement1; statement2; }
 // - factorial function: factorial(x)
 
-static ASTNode* parse_while_statement(void);
-static ASTNode* parse_repeat_statement(void);
-static ASTNode* parse_print_statement(void);
-static ASTNode* parse_block(void);
-static ASTNode* parse_factorial(void);
+static NodeId parse_while_statement(void);
+static NodeId parse_repeat_statement(void);
+static NodeId parse_print_statement(void);
+static NodeId parse_block(void);
+static void parse_block_body(NodeId block);
+static NodeId parse_factorial(void);
 
-static ASTNode *parse_statement(void);
-static ASTNode* parse_expression(void);
+static NodeId parse_statement(void);
+static NodeId parse_expression(void);
 // End of added
 
 // Current token being processed
 static Token current_token;
-static int position = 0;
+static const TokenBuffer *tokens;   // all tokens of the input
+static TokenBuffer own_tokens;      // tokens lexed by parser_init, or read from the pipe
+static size_t current;              // index of current_token in tokens
+static TokenPipe *pipe;             // or where the tokens come from, if not NULL
 static const char *source;
+static LineIndex lines;             // line starts of source, built on the first error
+static AST *ast;                    // tree being built
+static int panic;                   // after a syntax error, until the parser resynchronizes
+static int lazy;                    // skip block bodies (see parser_set_lazy)
+static int sharing;                 // share repeated expressions (see parser_set_share)
+static NodeId dropped;              // lazy blocks recover dropped, linked by sibling
+static NodeId dropped_last;
+static int dropping;                // parsing them (see parse_dropped)
+static jmp_buf out_of_memory_exit;  // where parse() returns 0 from
 
-static void parse_error(ParseError error, Token token) {
+// printf arguments for a "%.*s" conversion of a token's lexeme
+#define LEXEME(token) (int)(token).length, TOKEN_TEXT(source, token)
+
+static void parse_error(ParseError error, const Token *token) {
     // TODO 2: Add more error types for: - done
     // - Missing parentheses
     // - Missing condition
@@ -37,273 +55,705 @@ static void parse_error(ParseError error, Token token) {
     // - Invalid operator
     // - Function call errors
 
-    printf("Parse Error at line %d: & Column %d: \n", token.line, token.column);
+    SourceLocation where = parser_locate(token);
+    printf("Parse Error at line %d, column %d: \n", where.line, where.column);
     switch (error) {
         case PARSE_ERROR_UNEXPECTED_TOKEN:
-            printf("Unexpected token '%s'\n", token.lexeme);
+            printf("Unexpected token '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_MISSING_SEMICOLON:
-            printf("Missing semicolon after '%s'\n", token.lexeme);
+            printf("Missing semicolon after '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_MISSING_IDENTIFIER:
-            printf("Expected identifier after '%s'\n", token.lexeme);
+            printf("Expected identifier after '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_MISSING_EQUALS:
-            printf("Expected '=' after '%s'\n", token.lexeme);
+            printf("Expected '=' after '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_INVALID_EXPRESSION:
-            printf("Invalid expression after '%s'\n", token.lexeme);
+            printf("Invalid expression after '%.*s'\n", LEXEME(*token));
             break;
 
         // Part of TODO 2: -dharsan (expand)
         case PARSE_ERROR_MISSING_L_PAREN:
-            printf("Missing opening parenthesis after '%s'\n", token.lexeme);
+            printf("Missing opening parenthesis after '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_MISSING_R_PAREN:
-            printf("Missing closing parenthesis for expression starting with '%s'\n", token.lexeme);
+            printf("Missing closing parenthesis for expression starting with '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_MISSING_CONDITION:
-            printf("Missing condition after '%s'\n", token.lexeme);
+            printf("Missing condition after '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_MISSING_L_BRACE:
-            printf("Missing opening brace '{' after '%s'\n", token.lexeme);
+            printf("Missing opening brace '{' after '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_MISSING_R_BRACE:
-            printf("Missing closing brace '}' for block starting with '%s'\n", token.lexeme);
+            printf("Missing closing brace '}' for block starting with '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_INVALID_OPERATOR:
-            printf("Invalid operator '%s'\n", token.lexeme);
+            printf("Invalid operator '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_FUNCTION_CALL_NO_ARGUMENTS:
-            printf("Function '%s' called with no arguments but requires some\n", token.lexeme);
+            printf("Function '%.*s' called with no arguments but requires some\n", LEXEME(*token));
             break;
         case PARSE_ERROR_FUNCTION_CALL_INVALID_ARGUMENT:
-            printf("Invalid argument in call to function '%s'\n", token.lexeme);
+            printf("Invalid argument in call to function '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_FUNCTION_CALL_TOO_MANY_ARGUMENTS:
-            printf("Too many arguments in call to function '%s'\n", token.lexeme);
+            printf("Too many arguments in call to function '%.*s'\n", LEXEME(*token));
             break;
         case PARSE_ERROR_FUNCTION_UNDEFINED:
-            printf("Call to undefined function '%s'\n", token.lexeme);
+            printf("Call to undefined function '%.*s'\n", LEXEME(*token));
             break;
         default:
             printf("Unknown error\n");
     }
 }
 
+// Give up on the parse: parse() returns 0
+static void out_of_memory(void) {
+    longjmp(out_of_memory_exit, 1);
+}
+
+/* Error recovery
+ * A syntax error is reported and puts the parser in panic mode, in which
+ * further errors are not reported: they are most likely caused by the first
+ * one. The parser carries on with the statement it is in, as if the missing
+ * token had been there, and the loop over the statements of the block then
+ * skips ahead to the next statement boundary (see synchronize), replaces the
+ * statement with an AST_ERROR node and leaves panic mode. Errors inside a
+ * statement whose header already failed are part of that statement's error.
+ */
+static void syntax_error(ParseError error, const Token *token) {
+    if (panic) {
+        return;
+    }
+    panic = 1;
+    ast->errors++;
+    if (token->error != ERROR_NONE) {
+        // the token is the error: report the lexer's diagnosis
+        print_error(token->error, parser_locate(token), TOKEN_TEXT(source, *token), (int)token->length);
+    } else {
+        parse_error(error, token);
+    }
+}
+
 // Get next token
 static void advance(void) {
-    printf("%s\n", current_token.lexeme);
-    current_token = get_next_token(source, &position);
+    if (pipe) {
+        if (current_token.type != TOKEN_EOF) {
+            // keep the tokens read so far, the nodes refer to them by index
+            token_pipe_advance(pipe);
+            current_token = token_pipe_peek(pipe, 0);
+            if (!token_buffer_append(&own_tokens, &current_token, 1)) {
+                out_of_memory();
+            }
+            current++;
+        }
+        return;
+    }
+    if (current + 1 < tokens->count) {
+        current++;
+    }
+    current_token = token_buffer_get(tokens, current);
+}
+
+// Type of the token k places after the current one
+static TokenType peek(size_t k) {
+    if (pipe) {
+        return (TokenType)token_pipe_peek(pipe, k).type;
+    }
+    size_t i = current + k;
+    return (TokenType)tokens->type[i < tokens->count ? i : tokens->count - 1];
+}
+
+/* AST storage */
+
+void ast_init(AST *tree) {
+    memset(tree, 0, sizeof(AST));
 }
 
-// Create a new AST node
-static ASTNode *create_node(ASTNodeType type) {
-    ASTNode *node = malloc(sizeof(ASTNode));
-    if (node) {
-        node->type = type;
-        node->token = current_token;
-        node->left = NULL;
-        node->right = NULL;
-        node->args = NULL;
+void ast_reset(AST *tree) {
+    tree->count = 0;
+    tree->errors = 0;
+    tree->shared_count = 0;
+    if (tree->shared) {
+        memset(tree->shared, 0, tree->shared_cap * sizeof(NodeId));
+    }
+    tree->tokens = NULL;
+}
+
+void ast_free(AST *tree) {
+    free(tree->kind);
+    free(tree->child);
+    free(tree->sibling);
+    free(tree->token);
+    free(tree->name);
+    free(tree->shared);
+    ast_init(tree);
+}
+
+// Make room for at least need nodes
+static int ast_reserve(AST *tree, size_t need) {
+    if (need <= tree->cap) {
+        return 1;
+    }
+    size_t cap = tree->cap ? tree->cap : 256;
+    while (cap < need) cap *= 2;
+
+    uint8_t *kind = realloc(tree->kind, cap * sizeof(uint8_t));
+    if (!kind) return 0;
+    tree->kind = kind;
+    NodeId *child = realloc(tree->child, cap * sizeof(NodeId));
+    if (!child) return 0;
+    tree->child = child;
+    NodeId *sibling = realloc(tree->sibling, cap * sizeof(NodeId));
+    if (!sibling) return 0;
+    tree->sibling = sibling;
+    uint32_t *token = realloc(tree->token, cap * sizeof(uint32_t));
+    if (!token) return 0;
+    tree->token = token;
+    int *name = realloc(tree->name, cap * sizeof(int));
+    if (!name) return 0;
+    tree->name = name;
+
+    tree->cap = cap;
+    return 1;
+}
+
+Token ast_token(const AST *tree, NodeId node) {
+    return token_buffer_get(tree->tokens, tree->token[node]);
+}
+
+static int same_text(Token a, Token b) {
+    return a.type == b.type && a.length == b.length &&
+           memcmp(TOKEN_TEXT(parser_source(), a), TOKEN_TEXT(parser_source(), b), a.length) == 0;
+}
+
+static int is_paren(const TokenBuffer *tokens, size_t index) {
+    uint16_t type = token_buffer_get(tokens, index).type;
+    return type == TOKEN_LPAREN || type == TOKEN_RPAREN;
+}
+
+// An occurrence with the same tokens as the first has them as many tokens
+// away from the Ref's as they are from the shared node's. The occurrences can
+// only differ in parentheses, so if that token is another, the tokens in
+// between are counted without them
+uint32_t ast_token_here(const AST *tree, uint32_t shared, uint32_t here, uint32_t token) {
+    if (shared == here) {
+        return token;
+    }
+    const TokenBuffer *tokens = tree->tokens;
+    Token wanted = token_buffer_get(tokens, token);
+    int64_t guess = (int64_t)here + ((int64_t)token - shared);
+    if (guess >= 0 && same_text(token_buffer_get(tokens, (size_t)guess), wanted)) {
+        return (uint32_t)guess;
+    }
+
+    int64_t step = token < shared ? -1 : 1;
+    size_t between = 0;
+    for (int64_t i = (int64_t)shared + step; i != (int64_t)token; i += step) {
+        between += !is_paren(tokens, (size_t)i);
+    }
+    int64_t i = here;
+    while (i + step >= 0 && i + step < (int64_t)tokens->count) {
+        i += step;
+        if (is_paren(tokens, (size_t)i)) {
+            continue;
+        }
+        if (between == 0) {
+            return same_text(token_buffer_get(tokens, (size_t)i), wanted) ? (uint32_t)i : here;
+        }
+        between--;
+    }
+    return here;
+}
+
+int ast_is_condition(const AST *tree, NodeId parent, NodeId node) {
+    switch (tree->kind[parent]) {
+        case AST_IF:
+        case AST_WHILE:
+            return tree->sibling[node] != AST_NONE;  // the body comes last
+        case AST_REPEAT:
+            return node != tree->child[parent];      // the body comes first
+        default:
+            return 0;
+    }
+}
+
+// Copy the expression under node into new nodes, which nothing else shares;
+// a Ref in it is copied as a Ref to the same expression
+NodeId ast_copy(AST *tree, NodeId node) {
+    if (tree->cap < tree->count) {
+        return AST_NONE; // the nodes of a mapped image cannot grow
+    }
+    NodeId *pending = NULL; // nodes whose children are left, each with its copy
+    size_t count = 0;
+    size_t cap = 0;
+    NodeId copy = AST_NONE;
+    NodeId from = node;
+    NodeId parent = AST_NONE; // copy of the parent of from
+    NodeId last = AST_NONE;   // copy of the sibling before from
+
+    for (;;) {
+        while (from != AST_NONE) {
+            // the arrays may move, so the new node is linked in by index
+            if (tree->count == tree->cap && !ast_reserve(tree, tree->count + 1)) {
+                free(pending);
+                return AST_NONE;
+            }
+            NodeId to = (NodeId)tree->count++;
+            tree->kind[to] = tree->kind[from];
+            tree->child[to] = tree->kind[from] == AST_REF ? tree->child[from] : AST_NONE;
+            tree->sibling[to] = AST_NONE;
+            tree->token[to] = tree->token[from];
+            tree->name[to] = tree->name[from];
+            if (last != AST_NONE) {
+                tree->sibling[last] = to;
+            } else if (parent != AST_NONE) {
+                tree->child[parent] = to;
+            } else {
+                copy = to;
+            }
+            last = to;
+
+            if (tree->kind[from] != AST_REF && tree->child[from] != AST_NONE) {
+                if (count + 2 > cap) {
+                    cap = cap ? cap * 2 : 32;
+                    NodeId *grown = realloc(pending, cap * sizeof(NodeId));
+                    if (!grown) {
+                        free(pending);
+                        return AST_NONE;
+                    }
+                    pending = grown;
+                }
+                pending[count++] = from;
+                pending[count++] = to;
+            }
+            // the siblings of node are not part of it
+            from = from == node ? AST_NONE : tree->sibling[from];
+        }
+        if (count == 0) {
+            break;
+        }
+        parent = pending[--count];
+        from = tree->child[pending[--count]];
+        last = AST_NONE;
+    }
+    free(pending);
+    return copy;
+}
+
+/* Walking the tree */
+
+void ast_walk_init(AstWalk *walk, const AST *tree, NodeId root, int flags) {
+    walk->ast = tree;
+    walk->root = root;
+    walk->flags = flags;
+    walk->begun = 0;
+    walk->out_of_memory = 0;
+    walk->stack = NULL;
+    walk->count = 0;
+    walk->cap = 0;
+}
+
+void ast_walk_free(AstWalk *walk) {
+    free(walk->stack);
+    walk->stack = NULL;
+    walk->count = 0;
+    walk->cap = 0;
+}
+
+// Push node and report entering it
+static int walk_enter(AstWalk *walk, NodeId node, AstVisit *visit) {
+    if (walk->count == walk->cap) {
+        size_t cap = walk->cap ? walk->cap * 2 : 64;
+        AstFrame *grown = realloc(walk->stack, cap * sizeof(AstFrame));
+        if (!grown) {
+            walk->out_of_memory = 1;
+            return 0;
+        }
+        walk->stack = grown;
+        walk->cap = cap;
+    }
+    if ((walk->flags & AST_WALK_REFS) && walk->ast->kind[node] == AST_REF) {
+        node = walk->ast->child[node];
+    }
+    AstFrame *frame = &walk->stack[walk->count++];
+    frame->node = node;
+    frame->next = AST_NONE;
+    frame->started = 0;
+
+    visit->node = node;
+    visit->parent = walk->count > 1 ? walk->stack[walk->count - 2].node : AST_NONE;
+    visit->depth = walk->count - 1;
+    visit->event = AST_ENTER;
+    return 1;
+}
+
+int ast_walk_next(AstWalk *walk, AstVisit *visit) {
+    const AST *tree = walk->ast;
+    if (!walk->begun) {
+        walk->begun = 1;
+        return walk_enter(walk, walk->root, visit);
+    }
+    if (walk->count == 0 || walk->out_of_memory) {
+        return 0;
+    }
+
+    AstFrame *frame = &walk->stack[walk->count - 1];
+    if (!frame->started) {
+        frame->started = 1;
+        uint8_t kind = tree->kind[frame->node];
+        // the child of these is not a child list
+        if (kind != AST_LAZY_BLOCK && kind != AST_REF) {
+            frame->next = tree->child[frame->node];
+        }
+    }
+    if (frame->next != AST_NONE) {
+        NodeId child = frame->next;
+        frame->next = tree->sibling[child];
+        return walk_enter(walk, child, visit);
+    }
+
+    walk->count--;
+    visit->node = frame->node;
+    visit->parent = walk->count > 0 ? walk->stack[walk->count - 1].node : AST_NONE;
+    visit->depth = walk->count;
+    visit->event = AST_LEAVE;
+    return 1;
+}
+
+void ast_walk_skip(AstWalk *walk) {
+    AstFrame *frame = &walk->stack[walk->count - 1];
+    frame->started = 1;
+    frame->next = AST_NONE;
+}
+
+// Create a new AST node for the current token
+static NodeId create_node(ASTNodeType type) {
+    if (ast->count == ast->cap && !ast_reserve(ast, ast->count + 1)) {
+        out_of_memory();
+    }
+    NodeId node = (NodeId)ast->count++;
+    ast->kind[node] = (uint8_t)type;
+    ast->child[node] = AST_NONE;
+    ast->sibling[node] = AST_NONE;
+    ast->token[node] = (uint32_t)current;
+    ast->name[node] = -1;
+    if (current_token.type == TOKEN_IDENTIFIER) {
+        ast->name[node] = intern(TOKEN_TEXT(source, current_token), current_token.length);
+        if (ast->name[node] < 0) {
+            out_of_memory();
+        }
     }
     return node;
 }
 
+// Give parent the children first and second, in that order; either may be
+// AST_NONE (an expression that is missing)
+static void set_children(NodeId parent, NodeId first, NodeId second) {
+    if (first == AST_NONE) {
+        first = second;
+        second = AST_NONE;
+    }
+    ast->child[parent] = first;
+    if (first != AST_NONE) {
+        ast->sibling[first] = second;
+    }
+}
+
 // Match current token with expected type
 static int match(TokenType type) {
     return current_token.type == type;
 }
 
 // Expect a token type or error
-static void expect(TokenType type) {
+static void expect(TokenType type, ParseError error) {
     if (match(type)) {
         advance();
     } else {
-        parse_error(PARSE_ERROR_UNEXPECTED_TOKEN, current_token);
-        exit(1); // Or implement error recovery
+        syntax_error(error, &current_token); // and carry on as if it was there
     }
 }
 
+// Skip to where a statement can start: after a ';', or at a '{', a '}', a
+// keyword that starts a statement or an assignment (x =)
+static void synchronize(void) {
+    while (!match(TOKEN_EOF)) {
+        if (current > 0 && tokens->type[current - 1] == TOKEN_SEMICOLON) {
+            return;
+        }
+        switch (current_token.type) {
+            case TOKEN_IDENTIFIER:
+                if (peek(1) == TOKEN_EQUALS) {
+                    return;
+                }
+                advance();
+                break;
+            case TOKEN_LBRACE:
+            case TOKEN_RBRACE:
+            case TOKEN_INT:
+            case TOKEN_IF:
+            case TOKEN_WHILE:
+            case TOKEN_REPEAT:
+            case TOKEN_PRINT:
+                return;
+            default:
+                advance();
+        }
+    }
+}
+
+// The lazy blocks statement skipped before its syntax error, which the Error
+// node that replaces it drops: they are queued for parse_dropped, so that the
+// errors in them are reported as without lazy mode. The statement's nodes are
+// the ones made after its own, and a block met after the error was not skipped
+// (see skip_block)
+static void drop_lazy_blocks(NodeId statement) {
+    if (!lazy) {
+        return;
+    }
+    for (NodeId node = statement + 1; node < ast->count; node++) {
+        if (ast->kind[node] == AST_LAZY_BLOCK) {
+            // an empty Block from now on, so that it is queued only once
+            ast->kind[node] = AST_BLOCK;
+            ast->child[node] = AST_NONE;
+            ast->sibling[node] = AST_NONE;
+            if (dropped == AST_NONE) {
+                dropped = node;
+            } else {
+                ast->sibling[dropped_last] = node;
+            }
+            dropped_last = node;
+        }
+    }
+}
+
+// Recover from a syntax error in statement: resynchronize and return the
+// error node that replaces it
+static NodeId recover(NodeId statement) {
+    synchronize();
+    panic = 0;
+    drop_lazy_blocks(statement);
+    ast->kind[statement] = AST_ERROR;
+    ast->child[statement] = AST_NONE;
+    return statement;
+}
+
+// The parenthesized condition of an if, while or repeat statement
+static NodeId parse_condition(void) {
+    expect(TOKEN_LPAREN, PARSE_ERROR_MISSING_L_PAREN);
+    NodeId condition = parse_expression();
+    expect(TOKEN_RPAREN, PARSE_ERROR_MISSING_R_PAREN);
+    return condition;
+}
+
+// The end of a repeat statement after its body: until (condition)
+static NodeId parse_until(void) {
+    expect(TOKEN_UNTIL, PARSE_ERROR_UNEXPECTED_TOKEN);
+    return parse_condition();
+}
+
 // TODO 3: Add parsing functions for each new statement type
 // If statement parsing: if (condition) statement -done
-static ASTNode *parse_if_statement(void) {
-    ASTNode *node = create_node(AST_IF);
+static NodeId parse_if_statement(void) {
+    NodeId node = create_node(AST_IF);
     advance(); // consume 'if'
-    if (!match(TOKEN_LPAREN)) {
-        parse_error(PARSE_ERROR_MISSING_L_PAREN, current_token);
-        exit(1);
-    }
-    advance();
-    node->left = parse_expression(); // condition
-    if (!match(TOKEN_RPAREN)) {
-        parse_error(PARSE_ERROR_MISSING_R_PAREN, current_token);
-        exit(1);
-    }
-    advance();
-    node->right = parse_statement(); // statement after if
+    NodeId condition = parse_condition();
+    NodeId body = parse_statement(); // statement after if
+    set_children(node, condition, body);
     return node;
 }
 
 // While loop parsing: while (condition) statement -done
-static ASTNode* parse_while_statement(void) { 
-    ASTNode *node = create_node(AST_WHILE);
+static NodeId parse_while_statement(void) {
+    NodeId node = create_node(AST_WHILE);
     advance(); // consume 'while'
-    if (!match(TOKEN_LPAREN)) {
-        parse_error(PARSE_ERROR_MISSING_L_PAREN, current_token);
-        exit(1);
-    }
-    advance();
-    node->left = parse_expression(); // condition
-    if (!match(TOKEN_RPAREN)) {
-        parse_error(PARSE_ERROR_MISSING_R_PAREN, current_token);
-        exit(1);
-    }
-    advance();
-    node->right = parse_statement(); // loop body
+    NodeId condition = parse_condition();
+    NodeId body = parse_statement(); // loop body
+    set_children(node, condition, body);
     return node;
 }
 
 // Repeat-until loop parsing: repeat statement until (condition) -done
-static ASTNode* parse_repeat_statement(void) { 
-    ASTNode *node = create_node(AST_REPEAT);
-    advance();
-    node->left = parse_statement(); 
-    if (!match(TOKEN_UNTIL)){
-        parse_error(PARSE_ERROR_UNEXPECTED_TOKEN, current_token);
-        exit(1);
-    }
-    advance();
-    if (!match(TOKEN_LPAREN)) {
-        parse_error(PARSE_ERROR_MISSING_L_PAREN, current_token);
-        exit(1);
-    }
+static NodeId parse_repeat_statement(void) {
+    NodeId node = create_node(AST_REPEAT);
     advance();
-    node->right = parse_expression(); // condition
-    if (!match(TOKEN_RPAREN)) {
-        parse_error(PARSE_ERROR_MISSING_R_PAREN, current_token);
-        exit(1);
-    }
-    advance(); // consume ')'
+    NodeId body = parse_statement();
+    set_children(node, body, parse_until());
     return node;
 }
 
 // Print statement parsing: print expression - done 
-static ASTNode* parse_print_statement(void) { 
-    ASTNode *node = create_node(AST_PRINT);
-    advance();
-    node->left = parse_expression(); 
-    if (!match(TOKEN_SEMICOLON)) {
-        parse_error(PARSE_ERROR_MISSING_SEMICOLON, current_token);
-        exit(1);
-    }
+static NodeId parse_print_statement(void) {
+    NodeId node = create_node(AST_PRINT);
     advance();
+    set_children(node, parse_expression(), AST_NONE);
+    expect(TOKEN_SEMICOLON, PARSE_ERROR_MISSING_SEMICOLON);
     return node;
 }
 
 // Block parsing - done 
-static ASTNode* parse_block(void) { 
-    ASTNode *block_node = create_node(AST_BLOCK);
+static NodeId parse_block(void) {
+    NodeId block_node = create_node(AST_BLOCK);
+    parse_block_body(block_node);
+    return block_node;
+}
+
+#ifndef PARSER_STACK
+// The statements of a block, from its '{' to its '}'
+static void parse_block_body(NodeId block_node) {
     advance(); // consume '{'
 
-    ASTNode *current = NULL; // helpful for chaining statements
+    NodeId last = AST_NONE; // helpful for chaining statements
     // now, we parse the statements until we hit the closing brace.
 
     while (!match(TOKEN_RBRACE) && current_token.type != TOKEN_EOF) {
         // single statement parsing
-        ASTNode *statement = parse_statement();
-        // now if we are looking at the first statement in the block, attach it as the left child.
-        if (block_node->left == NULL) {
-            block_node->left = statement;
+        int inherited = panic; // the error is in the statement around the block
+        NodeId statement = parse_statement();
+        if (panic && !inherited) {
+            statement = recover(statement);
+        }
+        // the first statement is the block's first child, later ones follow
+        // it as siblings
+        if (last == AST_NONE) {
+            ast->child[block_node] = statement;
         } else {
-            // if we are not looking at the first statement, chain the statements together.
-            current->right = statement;
+            ast->sibling[last] = statement;
         }
-        // update the last statement to the current statement
-        current = statement;
+        last = statement;
     }
     // eat the closing brace
-    if (!match(TOKEN_RBRACE)) {
-        parse_error(PARSE_ERROR_MISSING_R_BRACE, current_token);
-        exit(1);
+    expect(TOKEN_RBRACE, PARSE_ERROR_MISSING_R_BRACE);
+}
+#endif
+
+/* Lazy blocks
+ * In lazy mode a block's body is not parsed along with the rest: the block
+ * becomes an AST_LAZY_BLOCK that remembers where its body ends, and
+ * ast_expand parses it once somebody walks into it. Finding the end takes a
+ * scan of the token types for the matching '}', which is much cheaper than
+ * parsing, and strings and comments are single tokens by then, so braces in
+ * them are not counted. Every '{' the parser meets opens a block and every
+ * '}' closes one, so the braces match the same way as the blocks.
+ *
+ * A block in a statement that already has a syntax error is parsed at once:
+ * its errors are not reported, as without lazy mode. When a statement fails
+ * after a block it skipped (repeat { ... } until with a bad condition), the
+ * Error node that replaces the statement drops the block, and it is parsed
+ * after the parse or ast_expand, just for its errors (see parse_dropped).
+ */
+
+// In lazy mode, skip the block at the current '{' and return an
+// AST_LAZY_BLOCK for it; AST_NONE if the block is to be parsed now
+static NodeId skip_block(void) {
+    if (!lazy || dropping || panic) {
+        return AST_NONE;
     }
-    advance(); // consume '}'
-    return block_node;
+    if (pipe) {
+        return AST_NONE; // the tokens after this one are not there yet
+    }
+    const uint16_t *type = tokens->type;
+    size_t depth = 0;
+    for (size_t i = current; i < tokens->count; i++) {
+        if (type[i] == TOKEN_LBRACE) {
+            depth++;
+        } else if (type[i] == TOKEN_RBRACE && --depth == 0) {
+            NodeId node = create_node(AST_LAZY_BLOCK);
+            ast->child[node] = (NodeId)i; // its '}'
+            current = i;
+            current_token = token_buffer_get(tokens, i);
+            advance(); // consume '}'
+            return node;
+        }
+    }
+    return AST_NONE; // no matching '}': parsing it reports the error
+}
+
+void parser_set_lazy(int on) {
+    lazy = on;
+}
+
+// Parse the blocks recover dropped, all the way down, to report the errors in
+// them. Their nodes stay out of the tree, and none of them is shared
+static void parse_dropped(void) {
+    dropping = 1;
+    while (dropped != AST_NONE) {
+        NodeId block = dropped;
+        dropped = ast->sibling[block];
+        ast->sibling[block] = AST_NONE;
+        current = ast->token[block];
+        current_token = token_buffer_get(tokens, current);
+        panic = 0;
+        parse_block_body(block);
+    }
+    dropping = 0;
 }
 
 // Factorial function call parsing
-static ASTNode* parse_factorial(void) { 
-    ASTNode *node = create_node(AST_FUNCTIONCALL);
+static NodeId parse_factorial(void) {
+    NodeId node = create_node(AST_FUNCTIONCALL);
     advance(); // consume 'factorial'
 
-    if (!match(TOKEN_LPAREN)) {
-        parse_error(PARSE_ERROR_MISSING_L_PAREN, current_token);
-        exit(1);
-    }
-    advance(); // consume '('
+    expect(TOKEN_LPAREN, PARSE_ERROR_MISSING_L_PAREN);
 
-    node->args = parse_expression(); // Parse argument
+    set_children(node, parse_expression(), AST_NONE); // Parse argument
     
-    if (!match(TOKEN_RPAREN)) {
-        parse_error(PARSE_ERROR_MISSING_R_PAREN, current_token);
-        exit(1);
-    }
-    advance(); // consume ')'
+    expect(TOKEN_RPAREN, PARSE_ERROR_MISSING_R_PAREN);
     return node;
 }
 
 // Parse variable declaration: int x;
-static ASTNode *parse_declaration(void) {
-    ASTNode *node = create_node(AST_VARDECL);
+static NodeId parse_declaration(void) {
     advance(); // consume 'int'
 
     if (!match(TOKEN_IDENTIFIER)) {
-        parse_error(PARSE_ERROR_MISSING_IDENTIFIER, current_token);
-        exit(1);
+        syntax_error(PARSE_ERROR_MISSING_IDENTIFIER, &current_token);
+        return create_node(AST_ERROR);
     }
 
-    node->token = current_token;
+    NodeId node = create_node(AST_VARDECL); // on the variable's token
     advance(); // consume x
 
-    if (!match(TOKEN_SEMICOLON)) {
-        parse_error(PARSE_ERROR_MISSING_SEMICOLON, current_token);
-        exit(1);
-    }
-    advance();
+    expect(TOKEN_SEMICOLON, PARSE_ERROR_MISSING_SEMICOLON);
     return node;
 }
 
 // Parse assignment: x = 5;
-static ASTNode *parse_assignment(void) {
-    ASTNode *node = create_node(AST_ASSIGN);
-    node->left = create_node(AST_IDENTIFIER);
-    node->left->token = current_token;
+static NodeId parse_assignment(void) {
+    NodeId node = create_node(AST_ASSIGN);
+    NodeId target = create_node(AST_IDENTIFIER);
     advance();
 
-    if (!match(TOKEN_EQUALS)) {
-        parse_error(PARSE_ERROR_MISSING_EQUALS, current_token);
-        exit(1);
-    }
-    advance(); // eat equals
+    expect(TOKEN_EQUALS, PARSE_ERROR_MISSING_EQUALS);
 
-    node->right = parse_expression();
+    set_children(node, target, parse_expression());
 
-    if (!match(TOKEN_SEMICOLON)) {
-        parse_error(PARSE_ERROR_MISSING_SEMICOLON, current_token);
-        exit(1);
-    }
-    advance();
+    expect(TOKEN_SEMICOLON, PARSE_ERROR_MISSING_SEMICOLON);
+    return node;
+}
+
+// Parse a call used as a statement: factorial(5);
+static NodeId parse_call_statement(void) {
+    NodeId node = parse_expression();
+
+    expect(TOKEN_SEMICOLON, PARSE_ERROR_MISSING_SEMICOLON);
     return node;
 }
 
 // Parse statement
-static ASTNode *parse_statement(void) {
-    if (match(TOKEN_KEYWORD)) {
+static NodeId parse_statement(void) {
+    if (match(TOKEN_INT)) {
         return parse_declaration();
+    } else if (match(TOKEN_IDENTIFIER) && peek(1) == TOKEN_LPAREN) {
+        return parse_call_statement();
     } else if (match(TOKEN_IDENTIFIER)) {
         return parse_assignment();
     } else if (match(TOKEN_LBRACE)) {
-        return parse_block();
+        NodeId block = skip_block();
+        return block != AST_NONE ? block : parse_block();
     } else if (match(TOKEN_IF)) {
         return parse_if_statement();
     } else if (match(TOKEN_WHILE)) {
@@ -314,23 +764,184 @@ static ASTNode *parse_statement(void) {
         return parse_print_statement();
     }
 
-    printf("Syntax Error: Unexpected token\n");
-    exit(1);
+    // not a statement: skip the token, unless it is a '}', which always
+    // closes the innermost block (so skip_block can find the end of a block
+    // by counting braces); at the top level the program skips it
+    syntax_error(PARSE_ERROR_UNEXPECTED_TOKEN, &current_token);
+    NodeId node = create_node(AST_ERROR);
+    if (!match(TOKEN_RBRACE)) {
+        advance();
+    }
+    return node;
+}
+
+/* Expressions
+ * Binary operators are parsed by precedence climbing: parse_binary(level)
+ * reads an operand and then, in a loop, every operator that binds at least as
+ * tightly as level, each followed by an operand of one level higher. A chain
+ * of operators of the same level is thus folded to the left by the loop
+ * (a - b - c is (a - b) - c), and the parser only recurses to read an
+ * operand that binds tighter, so the depth of the recursion is bounded by the
+ * number of levels (and by the nesting of parentheses), not by the length of
+ * the expression. Prefix + and - bind tighter than any binary operator.
+ */
+enum {
+    LEVEL_NONE,         // not a binary operator
+    LEVEL_COMPARISON,   // == < >
+    LEVEL_SUM,          // + -
+    LEVEL_PRODUCT,      // * / %
+};
+
+// Level of an operator token, by its first character (the only operator of
+// more than one character is ==)
+static const unsigned char binary_level[256] = {
+    ['='] = LEVEL_COMPARISON, ['<'] = LEVEL_COMPARISON, ['>'] = LEVEL_COMPARISON,
+    ['+'] = LEVEL_SUM, ['-'] = LEVEL_SUM,
+    ['*'] = LEVEL_PRODUCT, ['/'] = LEVEL_PRODUCT, ['%'] = LEVEL_PRODUCT,
+};
+
+static int operator_level(void) {
+    if (!match(TOKEN_OPERATOR)) {
+        return LEVEL_NONE;
+    }
+    return binary_level[(unsigned char)*TOKEN_TEXT(source, current_token)];
+}
+
+static int is_prefix_operator(void) {
+    if (!match(TOKEN_OPERATOR)) {
+        return 0;
+    }
+    char c = *TOKEN_TEXT(source, current_token);
+    return c == '+' || c == '-';
+}
+
+/* Shared expressions
+ * With sharing on (parser_set_share), an expression that was parsed before is
+ * not stored again: its nodes are dropped and a Ref to the first copy takes
+ * their place. Expressions are hash-consed bottom-up as they are completed,
+ * so the children of a shared node are shared nodes (or Refs to them) and two
+ * expressions are equal when their kinds, their tokens' text and their
+ * children are. Nothing else is made while an expression is parsed, so its
+ * nodes are the last ones in the arrays and dropping them just shortens the
+ * arrays. Function calls are not shared: a call is a statement of its own.
+ * A node can only have one parent in the child/sibling lists, which is what
+ * the Ref nodes are for; the tree then has a node for every distinct
+ * expression and one more for every repetition.
+ */
+
+// Shared node that node stands for
+static NodeId canonical(NodeId node) {
+    return ast->kind[node] == AST_REF ? ast->child[node] : node;
+}
+
+static uint32_t expression_hash(NodeId node) {
+    Token token = ast_token(ast, node);
+    const unsigned char *text = (const unsigned char *)TOKEN_TEXT(source, token);
+    uint32_t hash = 2166136261u ^ ast->kind[node];
+    for (uint32_t i = 0; i < token.length; i++) {
+        hash = (hash ^ text[i]) * 16777619u;
+    }
+    for (NodeId child = ast->child[node]; child != AST_NONE; child = ast->sibling[child]) {
+        hash = (hash ^ canonical(child)) * 16777619u;
+    }
+    return hash;
+}
+
+static int same_expression(NodeId a, NodeId b) {
+    if (ast->kind[a] != ast->kind[b]) {
+        return 0;
+    }
+    Token ta = ast_token(ast, a);
+    Token tb = ast_token(ast, b);
+    if (ta.length != tb.length ||
+        memcmp(TOKEN_TEXT(source, ta), TOKEN_TEXT(source, tb), ta.length) != 0) {
+        return 0;
+    }
+    NodeId ca = ast->child[a];
+    NodeId cb = ast->child[b];
+    while (ca != AST_NONE && cb != AST_NONE) {
+        if (canonical(ca) != canonical(cb)) {
+            return 0;
+        }
+        ca = ast->sibling[ca];
+        cb = ast->sibling[cb];
+    }
+    return ca == cb;
 }
 
-// Parse expression (handles numbers and identifiers)
-static ASTNode* parse_expression(void) {
-    ASTNode* node = NULL;
+// Slot of the shared expression equal to node, or the empty slot for it
+static NodeId *shared_slot(NodeId node) {
+    size_t mask = ast->shared_cap - 1;
+    size_t i = expression_hash(node) & mask;
+    while (ast->shared[i] != AST_NONE && !same_expression(node, ast->shared[i])) {
+        i = (i + 1) & mask;
+    }
+    return &ast->shared[i];
+}
+
+static void grow_shared(void) {
+    NodeId *old = ast->shared;
+    size_t old_cap = ast->shared_cap;
+    ast->shared_cap = old_cap ? old_cap * 2 : 1024;
+    ast->shared = calloc(ast->shared_cap, sizeof(NodeId));
+    if (!ast->shared) {
+        ast->shared = old;
+        ast->shared_cap = old_cap;
+        out_of_memory();
+    }
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i] != AST_NONE) {
+            *shared_slot(old[i]) = old[i];
+        }
+    }
+    free(old);
+}
+
+// Share the expression node, whose nodes are those from start on: return it,
+// or a Ref to an equal expression parsed before
+static NodeId share(NodeId node, size_t start) {
+    if (!sharing || dropping) {
+        return node;
+    }
+    if (2 * (ast->shared_count + 1) > ast->shared_cap) {
+        grow_shared();
+    }
+    NodeId *slot = shared_slot(node);
+    if (*slot == AST_NONE) {
+        *slot = node;
+        ast->shared_count++;
+        return node;
+    }
+    uint32_t token = ast->token[node];
+    ast->count = start; // drop the copy
+    NodeId ref = create_node(AST_REF);
+    ast->token[ref] = token; // for error messages about this copy
+    ast->name[ref] = ast->name[*slot];
+    ast->child[ref] = *slot;
+    return ref;
+}
+
+void parser_set_share(int on) {
+    sharing = on;
+}
+
+// Parse a number, a variable, a call or a parenthesized expression
+// Returns AST_NONE if there is no expression here
+static NodeId parse_primary(void) {
+    NodeId node = AST_NONE;
+    size_t start = ast->count;
     
     // Handle number literals
     if (match(TOKEN_NUMBER)) {
         node = create_node(AST_NUMBER);
         advance(); // consume number
+        node = share(node, start);
     } 
     // Handle identifiers (variables and function calls)
     else if (match(TOKEN_IDENTIFIER)) {
         // Special case for factorial function
-        if (strcmp(current_token.lexeme, "factorial") == 0) {
+        if (current_token.length == 9 &&
+            memcmp(TOKEN_TEXT(source, current_token), "factorial", 9) == 0) {
             return parse_factorial();
         }
         
@@ -339,19 +950,17 @@ static ASTNode* parse_expression(void) {
         
         // Check if it's a function call
         if (match(TOKEN_LPAREN)) {
-            node->type = AST_FUNCTIONCALL;
+            ast->kind[node] = AST_FUNCTIONCALL;
             advance(); // consume '('
             
             // Parse arguments if any
             if (!match(TOKEN_RPAREN)) {
-                node->args = parse_expression();
+                set_children(node, parse_expression(), AST_NONE);
             }
             
-            if (!match(TOKEN_RPAREN)) {
-                parse_error(PARSE_ERROR_MISSING_R_PAREN, current_token);
-                exit(1);
-            }
-            advance(); // consume ')'
+            expect(TOKEN_RPAREN, PARSE_ERROR_MISSING_R_PAREN);
+        } else {
+            node = share(node, start);
         }
     } 
     // Handle parenthesized expressions
@@ -359,129 +968,344 @@ static ASTNode* parse_expression(void) {
         advance(); // consume '('
         node = parse_expression();
         
-        if (!match(TOKEN_RPAREN)) {
-            parse_error(PARSE_ERROR_MISSING_R_PAREN, current_token);
-            exit(1);
-        }
-        advance(); // consume ')'
+        expect(TOKEN_RPAREN, PARSE_ERROR_MISSING_R_PAREN);
     }
-    // Handle operators
+    // A binary operator where an operand should be
     else if (match(TOKEN_OPERATOR)) {
-        node = create_node(AST_OPERATOR);
-        advance(); // consume operator
-        node->right = parse_expression();
-    }
-    else {
-        return NULL; // No expression found
+        syntax_error(PARSE_ERROR_INVALID_OPERATOR, &current_token);
     }
-    
-    // Handle binary operations
-    if (match(TOKEN_OPERATOR) && node != NULL) {
-        ASTNode* binop = create_node(AST_BINOP);
-        binop->left = node;
-        binop->token = current_token; // Store the operator
+    return node;
+}
+
+// Parse an operand: a primary expression after any number of prefix operators
+static NodeId parse_unary(void) {
+    size_t first = current; // the first prefix operator
+    while (is_prefix_operator()) {
         advance(); // consume operator
-        binop->right = parse_expression();
-        return binop;
     }
-    
+    size_t last = current;
+
+    size_t start = ast->count;
+    NodeId node = parse_primary();
+    // the nodes are made once the operand is there, from the innermost
+    // operator out, so that each one's subtree is complete when it is shared
+    while (last > first) {
+        NodeId op = create_node(AST_OPERATOR);
+        ast->token[op] = (uint32_t)--last; // not the current token
+        ast->name[op] = -1;
+        set_children(op, node, AST_NONE);
+        node = share(op, start);
+    }
     return node;
 }
 
-// Parse program (multiple statements)
-static ASTNode *parse_program(void) {
-    ASTNode *program = create_node(AST_PROGRAM);
-    ASTNode *current = program;
+// Parse operands joined by binary operators of at least the given level
+static NodeId parse_binary(int level) {
+    size_t start = ast->count; // where the nodes of left begin
+    NodeId left = parse_unary();
 
-    while (!match(TOKEN_EOF)) {
-        current->left = parse_statement();
-        if (!match(TOKEN_EOF)) {
-            current->right = create_node(AST_PROGRAM);
-            current = current->right;
+    for (;;) {
+        int op_level = operator_level();
+        if (op_level < level || left == AST_NONE) {
+            return left;
         }
+        NodeId node = create_node(op_level == LEVEL_COMPARISON ? AST_COMP : AST_BINOP); // on the operator
+        advance(); // consume operator
+        set_children(node, left, parse_binary(op_level + 1));
+        left = share(node, start);
     }
-
-    return program;
 }
 
-// Initialize parser
-void parser_init(const char *input) {
-    source = input;
-    position = 0;
-    advance(); // Get first token
+// Parse expression
+// Returns AST_NONE if there is no expression here
+static NodeId parse_expression(void) {
+    return parse_binary(LEVEL_COMPARISON);
 }
 
-// Main parse function
-ASTNode *parse(void) {
-    return parse_program();
-}
+#ifdef PARSER_STACK
+/* Statements on an explicit stack (build with -DPARSER_STACK)
+ * parse_statement recurses into parse_block, parse_if_statement and friends
+ * for every nested statement, so a few hundred thousand nested blocks or ifs
+ * run out of C stack. Here a statement that contains statements gets a frame
+ * on a heap-allocated stack instead, which lives until its body is complete,
+ * and the statements without a body are parsed by parse_statement as usual.
+ * Nesting is then only limited by memory. The nodes are created in the same
+ * order, so the tree is the same as the recursive parser's.
+ */
+typedef struct {
+    NodeId node;        // the program, a block, if, while or repeat
+    NodeId first;       // if, while: the condition; repeat: the body
+    NodeId last;        // program, block: the last statement so far
+    int done;           // if, while, repeat: the body has been parsed
+    int inherited;      // program, block: panic mode was on when the last statement started
+} Frame;
 
-// Print AST (for debugging)
-void print_ast(ASTNode *node, int level) {
-    if (!node) return;
+static Frame *frames;
+static size_t frame_cap;
 
-    // Indent based on level
-    for (int i = 0; i < level; i++) printf("  ");
+static void push_frame(size_t *depth, NodeId node, NodeId first) {
+    if (*depth == frame_cap) {
+        size_t cap = frame_cap ? frame_cap * 2 : 64;
+        Frame *grown = realloc(frames, cap * sizeof(Frame));
+        if (!grown) {
+            out_of_memory();
+        }
+        frames = grown;
+        frame_cap = cap;
+    }
+    frames[(*depth)++] = (Frame){.node = node, .first = first, .last = AST_NONE};
+}
 
-    // Print node info
-    switch (node->type) {
+// Start the statement at the current token: returns it if it is complete,
+// or AST_NONE if it has a body and was pushed
+static NodeId open_statement(size_t *depth) {
+    NodeId node;
+    switch (current_token.type) {
+        case TOKEN_LBRACE:
+            node = skip_block();
+            if (node != AST_NONE) {
+                return node;
+            }
+            node = create_node(AST_BLOCK);
+            advance(); // consume '{'
+            push_frame(depth, node, AST_NONE);
+            return AST_NONE;
+        case TOKEN_IF:
+        case TOKEN_WHILE:
+            node = create_node(match(TOKEN_IF) ? AST_IF : AST_WHILE);
+            advance(); // consume 'if' or 'while'
+            push_frame(depth, node, parse_condition());
+            return AST_NONE;
+        case TOKEN_REPEAT:
+            node = create_node(AST_REPEAT);
+            advance(); // consume 'repeat'
+            push_frame(depth, node, AST_NONE);
+            return AST_NONE;
+        default:
+            return parse_statement();
+    }
+}
+
+// Give a frame its next complete statement
+static void add_statement(Frame *frame, NodeId statement) {
+    switch (ast->kind[frame->node]) {
         case AST_PROGRAM:
-            printf("Program\n");
-            break;
-        case AST_VARDECL:
-            printf("VarDecl: %s\n", node->token.lexeme);
-            break;
-        case AST_ASSIGN:
-            printf("Assign\n");
-            break;
-        case AST_NUMBER:
-            printf("Number: %s\n", node->token.lexeme);
-            break;
-        case AST_IDENTIFIER:
-            printf("Identifier: %s\n", node->token.lexeme);
-            break;
-        case AST_FUNCTIONCALL:
-            printf("FunctionCall: %s\n", node->token.lexeme);
-            break;
-        case AST_IF:
-            printf("IfStatement: %s\n", node->token.lexeme);
-            break;
-        case AST_WHILE:
-            printf("WhileLoop: %s\n", node->token.lexeme);
-            break;
-        case AST_REPEAT:
-            printf("Repeat: %s\n", node->token.lexeme);
-            break;
-        case AST_PRINT:
-            printf("Print\n");
-            break;
         case AST_BLOCK:
-            printf("Block\n");
-            break;
-        case AST_BINOP:
-            printf("BinaryOp: %s\n", node->token.lexeme);
+            if (panic && !frame->inherited) {
+                statement = recover(statement);
+                if (ast->kind[frame->node] == AST_PROGRAM && match(TOKEN_RBRACE)) {
+                    advance(); // closes no block
+                }
+            }
+            if (frame->last == AST_NONE) {
+                ast->child[frame->node] = statement;
+            } else {
+                ast->sibling[frame->last] = statement;
+            }
+            frame->last = statement;
             break;
-        case AST_COMP:
-            printf("Comparison: %s\n", node->token.lexeme);
+        case AST_REPEAT:
+            frame->first = statement; // the condition follows it
+            frame->done = 1;
             break;
-        case AST_OPERATOR:
-            printf("Operator: %s\n", node->token.lexeme);
+        default: // if, while
+            set_children(frame->node, frame->first, statement);
+            frame->done = 1;
             break;
-        default:
-            printf("Unknown node type\n");
     }
+}
+
+// Parse the statements of list, the program or a block whose '{' has been
+// consumed, up to its end
+static void parse_statements(NodeId list) {
+    size_t depth = 0;
+    push_frame(&depth, list, AST_NONE);
+
+    while (depth > 0) {
+        Frame *top = &frames[depth - 1];
+        NodeId statement = AST_NONE; // completed in this step
+
+        // close the top frame if its statement is complete
+        switch (ast->kind[top->node]) {
+            case AST_PROGRAM:
+                if (match(TOKEN_EOF)) {
+                    depth--;
+                    continue;
+                }
+                break;
+            case AST_BLOCK:
+                if (match(TOKEN_RBRACE) || match(TOKEN_EOF)) {
+                    expect(TOKEN_RBRACE, PARSE_ERROR_MISSING_R_BRACE);
+                    statement = top->node;
+                }
+                break;
+            case AST_REPEAT:
+                if (top->done) {
+                    set_children(top->node, top->first, parse_until());
+                    statement = top->node;
+                }
+                break;
+            default: // if, while
+                if (top->done) {
+                    statement = top->node;
+                }
+                break;
+        }
+
+        if (statement != AST_NONE) {
+            if (--depth == 0) {
+                return; // the block we were asked for
+            }
+        } else {
+            // the top frame wants its next statement
+            top->inherited = panic;
+            statement = open_statement(&depth);
+            if (statement == AST_NONE) {
+                continue;
+            }
+        }
+        add_statement(&frames[depth - 1], statement);
+    }
+}
+
+static void parse_block_body(NodeId block) {
+    advance(); // consume '{'
+    parse_statements(block);
+}
+
+// Parse program (multiple statements)
+static void parse_program(void) {
+    parse_statements(create_node(AST_PROGRAM));
+}
+#else /* !PARSER_STACK */
+// Parse program (multiple statements)
+static void parse_program(void) {
+    NodeId program = create_node(AST_PROGRAM);
+    NodeId last = AST_NONE;
+
+    while (!match(TOKEN_EOF)) {
+        NodeId statement = parse_statement();
+        if (panic) {
+            statement = recover(statement);
+            if (match(TOKEN_RBRACE)) {
+                advance(); // closes no block
+            }
+        }
+        if (last == AST_NONE) {
+            ast->child[program] = statement;
+        } else {
+            ast->sibling[last] = statement;
+        }
+        last = statement;
+    }
+}
+#endif /* PARSER_STACK */
 
-    // Print children
-    print_ast(node->left, level + 1);
-    print_ast(node->right, level + 1);
+// Initialize parser on tokens lexed beforehand
+void parser_init_tokens(const TokenBuffer *buffer) {
+    source = buffer->source;
+    tokens = buffer;
+    pipe = NULL;
+    current = 0;
+    // the final TOKEN_EOF sits at the end of the text
+    line_index_free(&lines);
+    line_index_init(&lines, source, buffer->offset[buffer->count - 1]);
+    current_token = token_buffer_get(tokens, 0); // Get first token
 }
 
-// Free AST memory
-void free_ast(ASTNode *node) {
-    if (!node) return;
-    free_ast(node->left);
-    free_ast(node->right);
-    free(node);
+// Initialize parser on tokens coming out of a pipelined lexer
+int parser_init_pipe(TokenPipe *tokens_in, const char *text, size_t size) {
+    source = text;
+    pipe = tokens_in;
+    current = 0;
+    line_index_free(&lines);
+    line_index_init(&lines, source, size);
+    current_token = token_pipe_peek(pipe, 0);
+    // the tokens are collected as they are read (see advance)
+    token_buffer_free(&own_tokens);
+    token_buffer_init(&own_tokens, source);
+    tokens = &own_tokens;
+    return token_buffer_append(&own_tokens, &current_token, 1);
+}
+
+// Initialize parser
+int parser_init(const char *input) {
+    token_buffer_free(&own_tokens);
+    if (!token_buffer_lex(&own_tokens, input, strlen(input))) {
+        return 0;
+    }
+    parser_init_tokens(&own_tokens);
+    return 1;
+}
+
+// Source text the tokens in the AST point into
+const char *parser_source(void) {
+    return source;
+}
+
+// Line and column of a token of the source being parsed
+SourceLocation parser_locate(const Token *token) {
+    return line_index_locate(&lines, token->offset);
+}
+
+// Main parse function
+int parse(AST *tree) {
+    ast = tree;
+    ast_reset(ast);
+    // about one node per token
+    if (!ast_reserve(ast, tokens->count)) {
+        return 0;
+    }
+    ast->tokens = tokens;
+    ast->sharing = sharing;
+    panic = 0;
+    dropped = AST_NONE;
+    if (setjmp(out_of_memory_exit)) {
+        dropping = 0;
+        return 0;
+    }
+    parse_program();
+    parse_dropped();
+    return 1;
+}
+
+// Parse the body of a block skipped in lazy mode
+int ast_expand(AST *tree, NodeId block) {
+    if (tree->kind[block] != AST_LAZY_BLOCK) {
+        return 1;
+    }
+    // the parser picks up where the block starts, on the text and with the
+    // sharing setting and shared expressions of the tree, which need not be
+    // the last one parsed; the pipe, if there was one, is closed, but all the
+    // tokens it delivered are in tree->tokens
+    ast = tree;
+    tokens = tree->tokens;
+    source = tokens->source;
+    if (lines.text != source) {
+        line_index_free(&lines);
+        line_index_init(&lines, source, tokens->offset[tokens->count - 1]);
+    }
+    int sharing_setting = sharing;
+    sharing = tree->sharing;
+    pipe = NULL;
+    panic = 0;
+    dropped = AST_NONE;
+    NodeId end = tree->child[block];
+    current = tree->token[block];
+    current_token = token_buffer_get(tokens, current);
+    if (setjmp(out_of_memory_exit)) {
+        tree->kind[block] = AST_LAZY_BLOCK; // try again later
+        tree->child[block] = end;
+        sharing = sharing_setting;
+        dropping = 0;
+        return 0;
+    }
+    tree->kind[block] = AST_BLOCK;
+    tree->child[block] = AST_NONE;
+    parse_block_body(block);
+    parse_dropped();
+    sharing = sharing_setting;
+    return 1;
 }
 
 // // Main function for testing
@@ -0,0 +1,426 @@
+/* resolve.c - binding names to their declarations */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/semantic.h"
+#include "../../include/parser.h"
+
+static AST* tree;                   // tree being resolved
+static Resolution* res;             // what is found out about it
+static SymbolTable* table;          // the declarations in scope where the walk is
+static unsigned long* verified;     // by NodeId: table generation at which its own names matched
+static NodeId* last_copy;           // by NodeId of a shared node: the copy made last, or AST_NONE
+static size_t verified_cap;         // of both
+static NodeId* refs;                // Refs left to resolve in the current expression
+static size_t ref_count;
+static size_t ref_cap;
+static NodeId* targets;             // shared nodes left to compare, for matches()
+static size_t target_cap;
+static NodeId* pending;             // nodes of an expression left to visit
+static size_t pending_cap;
+
+// Append node to a growable list of nodes; 0 if out of memory
+static int push_node(NodeId** list, size_t* count, size_t* cap, NodeId node) {
+    if (*count == *cap) {
+        size_t grown_cap = *cap ? *cap * 2 : 64;
+        NodeId* grown = realloc(*list, grown_cap * sizeof(NodeId));
+        if (!grown) {
+            return 0;
+        }
+        *list = grown;
+        *cap = grown_cap;
+    }
+    (*list)[(*count)++] = node;
+    return 1;
+}
+
+// Cover the nodes the tree has now, which grows with lazy blocks and copies
+static int reserve_nodes(void) {
+    size_t count = tree->count;
+    if (count <= res->nodes) {
+        return 1;
+    }
+    int* symbol = realloc(res->symbol, count * sizeof(int));
+    if (!symbol) {
+        return 0;
+    }
+    res->symbol = symbol;
+    for (size_t i = res->nodes; i < count; i++) {
+        symbol[i] = SYMBOL_UNRESOLVED;
+    }
+    res->nodes = count;
+    return 1;
+}
+
+// Cover the nodes in verified and last_copy too, once there are Refs
+static int reserve_shared(void) {
+    size_t count = tree->count;
+    if (count <= verified_cap) {
+        return 1;
+    }
+    size_t cap = verified_cap ? verified_cap : 1024;
+    while (cap < count) cap *= 2;
+    unsigned long* grown = realloc(verified, cap * sizeof(unsigned long));
+    if (!grown) {
+        return 0;
+    }
+    verified = grown;
+    NodeId* copies = realloc(last_copy, cap * sizeof(NodeId));
+    if (!copies) {
+        return 0;
+    }
+    last_copy = copies;
+    memset(verified + verified_cap, 0, (cap - verified_cap) * sizeof(unsigned long));
+    memset(last_copy + verified_cap, 0, (cap - verified_cap) * sizeof(NodeId));
+    verified_cap = cap;
+    return 1;
+}
+
+// Symbol the name means where the walk is
+static int lookup(int name) {
+    Symbol* symbol = lookup_symbol(table, name);
+    return symbol ? symbol->id : SYMBOL_NONE;
+}
+
+// Declare the variable of a VarDecl: its symbol id, -1 if out of memory
+static int declare(NodeId node) {
+    if (res->count == res->cap) {
+        int cap = res->cap ? res->cap * 2 : 256;
+        int* name = realloc(res->name, cap * sizeof(int));
+        if (name) res->name = name;
+        int* type = realloc(res->type, cap * sizeof(int));
+        if (type) res->type = type;
+        int* scope_level = realloc(res->scope_level, cap * sizeof(int));
+        if (scope_level) res->scope_level = scope_level;
+        uint32_t* declared_at = realloc(res->declared_at, cap * sizeof(uint32_t));
+        if (declared_at) res->declared_at = declared_at;
+        int* slot = realloc(res->slot, cap * sizeof(int));
+        if (slot) res->slot = slot;
+        if (!name || !type || !scope_level || !declared_at || !slot) {
+            return -1;
+        }
+        res->cap = cap;
+    }
+
+    // the slot after that of the last symbol in scope: the symbols of a
+    // scope that has been left give theirs back
+    int slot = table->count > 0 ? res->slot[table->symbols[table->count - 1].id] + 1 : 0;
+    Symbol* symbol = add_symbol(table, tree->name[node], TYPE_INT, ast_token(tree, node).offset);
+    if (!symbol) {
+        return -1;
+    }
+    int id = res->count++;
+    symbol->id = id;
+    res->name[id] = symbol->name;
+    res->type[id] = symbol->type;
+    res->scope_level[id] = symbol->scope_level;
+    res->declared_at[id] = symbol->declared_at;
+    res->slot[id] = slot;
+    if (slot + 1 > res->slots) {
+        res->slots = slot + 1;
+    }
+    return id;
+}
+
+// Push the children of node, which is not a Ref, to visit; 0 if out of memory
+static int push_children(NodeId node, size_t* count) {
+    for (NodeId child = tree->child[node]; child != AST_NONE; child = tree->sibling[child]) {
+        if (!push_node(&pending, count, &pending_cap, child)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Bind the names under node, which only this occurrence reaches; the Refs
+// in it are left in refs. Expressions are small and there are many of them,
+// so they are visited off one stack kept for the whole pass rather than an
+// AstWalk each. 0 if out of memory
+static int bind(NodeId node) {
+    size_t count = 0;
+    if (!push_node(&pending, &count, &pending_cap, node)) {
+        return 0;
+    }
+    while (count > 0) {
+        node = pending[--count];
+        if (tree->kind[node] == AST_IDENTIFIER) {
+            res->symbol[node] = lookup(tree->name[node]);
+        } else if (tree->kind[node] == AST_REF) {
+            res->symbol[node] = SYMBOL_NONE;
+            if (!push_node(&refs, &ref_count, &ref_cap, node)) {
+                return 0;
+            }
+            continue;
+        } else {
+            res->symbol[node] = SYMBOL_NONE;
+        }
+        if (!push_children(node, &count)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Whether the names in the shared expression, through the Refs in it, are
+// bound to what they mean where the walk is. In lazy mode an expression can
+// be repeated before it is reached where it was written; it is not bound
+// then, and its Refs could still change, so it does not match. The shared
+// nodes it reaches are remembered as matching at the table's generation and
+// not looked at again, so an expression is compared in time linear in its
+// shared nodes rather than in its size written out. -1 if out of memory
+static int matches(NodeId expression) {
+    size_t count = 0;
+    int result = 1;
+    if (!push_node(&targets, &count, &target_cap, expression)) {
+        return -1;
+    }
+    for (size_t i = 0; result == 1 && i < count; i++) {
+        NodeId shared = targets[i];
+        if (verified[shared] == table->generation || verified[shared] == ~table->generation) {
+            continue; // matches, and so does everything under it; or is being compared
+        }
+        verified[shared] = ~table->generation;
+        size_t left = 0;
+        if (!push_node(&pending, &left, &pending_cap, shared)) {
+            result = -1;
+        }
+        while (result == 1 && left > 0) {
+            NodeId node = pending[--left];
+            if (res->symbol[node] == SYMBOL_UNRESOLVED) {
+                result = 0;
+            } else if (tree->kind[node] == AST_IDENTIFIER) {
+                if (res->symbol[node] != lookup(tree->name[node])) {
+                    result = 0;
+                }
+            } else if (tree->kind[node] == AST_REF) {
+                if (!push_node(&targets, &count, &target_cap, tree->child[node])) {
+                    result = -1;
+                }
+                continue;
+            }
+            if (result == 1 && !push_children(node, &left)) {
+                result = -1;
+            }
+        }
+    }
+    // only now is it known whether what is under each of them matches too
+    for (size_t i = 0; i < count; i++) {
+        verified[targets[i]] = result == 1 ? table->generation : 0;
+    }
+    return result;
+}
+
+// Resolve the expression under node; 0 if out of memory
+static int resolve_expression(NodeId node) {
+    if (node == AST_NONE) {
+        return 1;
+    }
+    ref_count = 0;
+    if (!reserve_nodes() || !bind(node)) {
+        return 0;
+    }
+    if (ref_count > 0 && !reserve_shared()) {
+        return 0;
+    }
+    while (ref_count > 0) {
+        NodeId ref = refs[--ref_count];
+        NodeId shared = tree->child[ref];
+        int same = matches(shared);
+        if (same == 1) {
+            continue;
+        }
+
+        // its names mean something else here than where it was bound (or it
+        // has not been bound yet): it shares the last copy made of the
+        // expression if that fits, or gets nodes of its own
+        NodeId copy = last_copy[shared];
+        if (same == 0 && copy != AST_NONE) {
+            same = matches(copy);
+            if (same == 1) {
+                tree->child[ref] = copy;
+                continue;
+            }
+        }
+        if (same == -1) {
+            return 0;
+        }
+        if (tree->cap < tree->count && res->symbol[shared] == SYMBOL_UNRESOLVED) {
+            // a mapped image was saved with its copies made, and a node no
+            // occurrence has bound is one of them: it is bound here, as it
+            // was when it was made
+            if (!bind(shared)) {
+                return 0;
+            }
+            continue;
+        }
+        copy = ast_copy(tree, shared);
+        if (copy == AST_NONE || !reserve_nodes() || !reserve_shared()) {
+            return 0;
+        }
+        tree->child[ref] = copy;
+        last_copy[shared] = copy;
+        if (!bind(copy)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Resolve the arguments of a call
+static int resolve_arguments(NodeId call) {
+    int ok = 1;
+    for (NodeId argument = tree->child[call]; argument != AST_NONE; argument = tree->sibling[argument]) {
+        ok &= resolve_expression(argument);
+    }
+    return ok;
+}
+
+// Walk the statements, entering and leaving scopes where the checker always
+// has, and bind the names in them
+static int resolve_statements(void) {
+    int ok = 1;
+    AstWalk walk;
+    AstVisit visit;
+
+    ast_walk_init(&walk, tree, AST_ROOT, 0);
+    while (ok && ast_walk_next(&walk, &visit)) {
+        NodeId node = visit.node;
+
+        if (visit.event == AST_LEAVE) {
+            switch (tree->kind[node]) {
+                case AST_BLOCK:
+                case AST_IF:
+                case AST_WHILE:
+                    exit_scope(table);
+                    break;
+
+                case AST_REPEAT:
+                    // the condition is outside the body's scope
+                    exit_scope(table);
+                    ok = resolve_expression(tree->sibling[tree->child[node]]);
+                    break;
+
+                default:
+                    break;
+            }
+            continue;
+        }
+
+        if (ast_is_condition(tree, visit.parent, node)) {
+            ast_walk_skip(&walk); // resolved along with its statement
+            continue;
+        }
+
+        ok = reserve_nodes();
+        res->symbol[node] = SYMBOL_NONE;
+        switch (tree->kind[node]) {
+            case AST_VARDECL:
+                if (lookup_symbol_current_scope(table, tree->name[node])) {
+                    res->symbol[node] = SYMBOL_REDECLARED;
+                } else {
+                    res->symbol[node] = declare(node);
+                    ok &= res->symbol[node] >= 0;
+                }
+                break;
+
+            case AST_ASSIGN: {
+                NodeId target = tree->child[node];
+                if (target != AST_NONE) {
+                    res->symbol[node] = lookup(tree->name[target]);
+                    res->symbol[target] = res->symbol[node];
+                    ok &= resolve_expression(tree->sibling[target]);
+                }
+                ast_walk_skip(&walk);
+                break;
+            }
+
+            case AST_PRINT:
+                ok &= resolve_expression(tree->child[node]);
+                ast_walk_skip(&walk);
+                break;
+
+            case AST_BLOCK:
+            case AST_LAZY_BLOCK:
+                if (!ast_expand(tree, node)) {
+                    fprintf(stderr, "Out of memory\n");
+                    break; // still a LazyBlock: no children, no scope
+                }
+                enter_scope(table);
+                break;
+
+            case AST_IF:
+            case AST_WHILE: {
+                NodeId condition = tree->child[node];
+                if (tree->sibling[condition] != AST_NONE) {
+                    ok &= resolve_expression(condition);
+                }
+                enter_scope(table);
+                break;
+            }
+
+            case AST_REPEAT:
+                enter_scope(table);
+                break;
+
+            case AST_FUNCTIONCALL:
+                ok &= resolve_arguments(node);
+                ast_walk_skip(&walk);
+                break;
+
+            case AST_NUMBER:
+            case AST_IDENTIFIER:
+            case AST_BINOP:
+            case AST_COMP:
+            case AST_OPERATOR:
+            case AST_REF:
+                // an expression used as a statement
+                ok &= resolve_expression(node);
+                ast_walk_skip(&walk);
+                break;
+
+            default:
+                break;
+        }
+    }
+    ok &= !walk.out_of_memory;
+    ast_walk_free(&walk);
+    return ok;
+}
+
+int resolve_names(AST* ast, Resolution* names) {
+    memset(names, 0, sizeof(Resolution));
+    tree = ast;
+    res = names;
+    table = init_symbol_table();
+    int ok = table && resolve_statements() && reserve_nodes();
+
+    if (table) {
+        free_symbol_table(table);
+        table = NULL;
+    }
+    free(verified);
+    verified = NULL;
+    free(last_copy);
+    last_copy = NULL;
+    verified_cap = 0;
+    free(refs);
+    refs = NULL;
+    ref_count = ref_cap = 0;
+    free(targets);
+    targets = NULL;
+    target_cap = 0;
+    free(pending);
+    pending = NULL;
+    pending_cap = 0;
+    return ok;
+}
+
+void free_resolution(Resolution* names) {
+    free(names->symbol);
+    free(names->name);
+    free(names->type);
+    free(names->scope_level);
+    free(names->declared_at);
+    free(names->slot);
+    memset(names, 0, sizeof(Resolution));
+}
@@ -5,60 +5,136 @@
 #include "../../include/parser.h"
 #include "../../include/lexer.h"
 #include "../../include/tokens.h"
+#include "../../include/intern.h"
 
 
 // Declare functions to resolve circular dependencies
-int check_statement(ASTNode* node, SymbolTable* table);
-int check_block(ASTNode* node, SymbolTable* table);
-int check_condition(ASTNode* node, SymbolTable* table);
-int check_expression(ASTNode* node, SymbolTable* table);
+int check_statement(const AST* ast, NodeId node, Resolution* names);
+int check_condition(const AST* ast, NodeId node, Resolution* names);
+int check_expression(const AST* ast, NodeId node, Resolution* names);
+
+/* Shared expressions
+ * An expression the parser shared (see parser_set_share) is checked once for
+ * all its occurrences: its names mean the same symbols in each of them (see
+ * resolve_names), and a variable that has been initialized stays so, so a
+ * check that found nothing wrong holds for good and its type is remembered.
+ * A check that reported an error is not remembered, so every occurrence
+ * reports its own errors. The copy's own tokens were dropped by the parser,
+ * so they are found from the Ref's (see ast_token_here), and an error is
+ * reported where it would be without sharing.
+ */
+typedef struct {
+    int checked;                // type holds for every occurrence
+    int type;
+} Memo;
+
+static Memo* memo;              // by NodeId of the shared node
+static size_t memo_cap;
+static unsigned long reported;  // semantic errors reported so far
+static uint32_t site_shared;    // token of the shared expression being checked
+static uint32_t site_here;      // token of the Ref it is checked for; site_shared outside Refs
+static unsigned char* initialized; // by symbol id: has been assigned a value
 
 
 // Initializing new symbol table
 SymbolTable* init_symbol_table() {
-    SymbolTable* table = (SymbolTable*)malloc(sizeof(SymbolTable));
+    SymbolTable* table = (SymbolTable*)calloc(1, sizeof(SymbolTable));
     if (table){
-        table->head = NULL;
         table->current_scope = 0;
+        table->generation = 1;
     }
     return table;
 }
 
+// Slot of name in the name table: where it is, or the empty slot it would go in
+static SymbolSlot* find_slot(SymbolSlot* slots, int cap, int name) {
+    unsigned mask = (unsigned)cap - 1;
+    unsigned i = ((unsigned)name * 2654435761u) & mask;
+    while (slots[i].name != -1 && slots[i].name != name) {
+        i = (i + 1) & mask;
+    }
+    return &slots[i];
+}
+
+// Double the name table (or create it), keeping it at most half full
+static int grow_slots(SymbolTable* table) {
+    int cap = table->slot_cap ? table->slot_cap * 2 : 64;
+    SymbolSlot* slots = malloc(cap * sizeof(SymbolSlot));
+    if (!slots) {
+        return 0;
+    }
+    for (int i = 0; i < cap; i++) {
+        slots[i].name = -1;
+        slots[i].symbol = -1;
+    }
+    for (int i = 0; i < table->slot_cap; i++) {
+        if (table->slots[i].name != -1) {
+            *find_slot(slots, cap, table->slots[i].name) = table->slots[i];
+        }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slot_cap = cap;
+    return 1;
+}
+
 // Adding a symbol to the table
-void add_symbol(SymbolTable* table, const char* name, int type, int line) {
-    Symbol* symbol = (Symbol*)malloc(sizeof(Symbol));
-    if (symbol) {
-    strcpy(symbol->name, name);
+Symbol* add_symbol(SymbolTable* table, int name, int type, uint32_t offset) {
+    if (table->count == table->cap) {
+        int cap = table->cap ? table->cap * 2 : 64;
+        Symbol* grown = realloc(table->symbols, cap * sizeof(Symbol));
+        if (!grown) {
+            return NULL;
+        }
+        table->symbols = grown;
+        table->cap = cap;
+    }
+    if (2 * (table->slot_count + 1) > table->slot_cap && !grow_slots(table)) {
+        return NULL;
+    }
+
+    SymbolSlot* slot = find_slot(table->slots, table->slot_cap, name);
+    if (slot->name == -1) {
+        slot->name = name;
+        table->slot_count++;
+    }
+    Symbol* symbol = &table->symbols[table->count];
+    symbol->name = name;
     symbol->type = type;
     symbol->scope_level = table->current_scope;
-    symbol->line_declared = line;
+    symbol->declared_at = offset;
     symbol->is_initialized = 0;
-    symbol->next = table->head;
-    table->head = symbol;
-    }   
+    symbol->shadowed = slot->symbol;
+    symbol->id = -1;
+    slot->symbol = table->count++;
+    table->generation++;
+    return symbol;
 }
 
 // Look up symbol by name
-Symbol* lookup_symbol(SymbolTable* table, const char* name) {
-    Symbol* current = table->head;
-    while (current) {
-        if (strcmp(current->name, name) == 0) {
-            return current;
-        }
-        current = current->next;
+Symbol* lookup_symbol(SymbolTable* table, int name) {
+    if (table->slot_cap == 0) {
+        return NULL;
     }
-    return NULL;
+    int symbol = find_slot(table->slots, table->slot_cap, name)->symbol;
+    return symbol == -1 ? NULL : &table->symbols[symbol];
 }
 
-// Look up symbol in current scope only
-Symbol* lookup_symbol_current_scope(SymbolTable* table, const char* name) {
-    Symbol* current = table->head;
-    while (current) {
-        if (strcmp(current->name, name) == 0 && 
-            current->scope_level == table->current_scope) {
-            return current;
+// Look up symbol in current scope only. It may be hidden by one from the
+// scope just left, which stays until this one is left; and under a symbol of
+// level m there are none deeper than m + 1, so the walk down the symbols of
+// the name ends within a couple of levels.
+Symbol* lookup_symbol_current_scope(SymbolTable* table, int name) {
+    if (table->slot_cap == 0) {
+        return NULL;
+    }
+    int level = table->current_scope;
+    int symbol = find_slot(table->slots, table->slot_cap, name)->symbol;
+    while (symbol != -1 && table->symbols[symbol].scope_level >= level - 1) {
+        if (table->symbols[symbol].scope_level == level) {
+            return &table->symbols[symbol];
         }
-        current = current->next;
+        symbol = table->symbols[symbol].shadowed;
     }
     return NULL;
 }
@@ -67,6 +143,19 @@ Symbol* lookup_symbol_current_scope(SymbolTable* table, const char* name) {
 // Entering a new scope level
 void enter_scope(SymbolTable* table) {
     table->current_scope++;
+    if (table->current_scope >= table->mark_cap) {
+        int cap = table->mark_cap ? table->mark_cap * 2 : 64;
+        int* grown = realloc(table->marks, cap * sizeof(int));
+        if (!grown) {
+            return; // without a mark the scope is left by going over the whole stack
+        }
+        for (int i = table->mark_cap; i < cap; i++) {
+            grown[i] = 0;
+        }
+        table->marks = grown;
+        table->mark_cap = cap;
+    }
+    table->marks[table->current_scope] = table->count;
 }
 
 // Exiting the current scope
@@ -75,41 +164,49 @@ void exit_scope(SymbolTable* table) {
     table->current_scope--;
 }
 
-// Removing symbols from the current scope
+// Removing symbols from the current scope: those declared deeper than it.
+// A scope's own symbols go when the scope around it is left, as they always
+// have, so the ones declared since the scope was entered are taken back and
+// those of this level declared again; each symbol is gone over at most twice.
 void remove_symbols_in_current_scope(SymbolTable* table) {
-    Symbol* current = table->head;
-    Symbol* prev = NULL;
-    while (current != NULL) {
-        if (current->scope_level > table->current_scope) {
-            if (prev == NULL) {
-                table->head = current->next;
-            } else {
-                prev->next = current->next;
-            }
-            Symbol* temp = current;
-            current = current->next;
-            free(temp);
-        } else {
-            prev = current;
-            current = current->next;
+    int level = table->current_scope;
+    int start = level > 0 && level < table->mark_cap ? table->marks[level] : 0;
+    int end = table->count;
+
+    // undo the declarations, innermost first
+    for (int i = end; i-- > start;) {
+        Symbol* symbol = &table->symbols[i];
+        find_slot(table->slots, table->slot_cap, symbol->name)->symbol = symbol->shadowed;
+    }
+
+    // and redo the ones that stay, in their order
+    table->count = start;
+    for (int i = start; i < end; i++) {
+        Symbol symbol = table->symbols[i];
+        if (symbol.scope_level > level) {
+            table->generation++;
+            continue;
         }
+        SymbolSlot* slot = find_slot(table->slots, table->slot_cap, symbol.name);
+        symbol.shadowed = slot->symbol;
+        slot->symbol = table->count;
+        table->symbols[table->count++] = symbol;
     }
 }
 
 // Freeing the symbol table memory
 void free_symbol_table(SymbolTable* table) {
-    Symbol* current = table->head;
-    while (current != NULL) {
-        Symbol* temp = current;
-        current = current->next;
-        free(temp);
-    }
+    free(table->symbols);
+    free(table->slots);
+    free(table->marks);
     free(table);
 }
 
 // Semantic Error Reporting
-void semantic_error(SemanticErrorType error, const char* name, int line) {
-    printf("Semantic Error at line %d: ", line);
+void semantic_error(SemanticErrorType error, const char* name, const Token* token) {
+    SourceLocation where = parser_locate(token);
+    reported++;
+    printf("Semantic Error at line %d, column %d: ", where.line, where.column);
     switch (error) {
         case SEM_ERROR_UNDECLARED_VARIABLE:
             printf("Undeclared variable '%s'\n", name);
@@ -145,14 +242,25 @@ void semantic_error(SemanticErrorType error, const char* name, int line) {
 //    return 1;
 // }
 
+// Token of node in the occurrence being checked (see ast_token_here)
+static Token token_here(const AST* ast, NodeId node) {
+    return token_buffer_get(ast->tokens, ast_token_here(ast, site_shared, site_here, ast->token[node]));
+}
+
+// Report error at the token of node
+static void node_error(SemanticErrorType error, const char* name, const AST* ast, NodeId node) {
+    Token token = token_here(ast, node);
+    semantic_error(error, name, &token);
+}
+
 // check a condition (e.g., in if/while statements)
-int check_condition(ASTNode* node, SymbolTable* table) {
-    if (node == NULL) {
-        return 0;  // invalid if condition is NULL
+int check_condition(const AST* ast, NodeId node, Resolution* names) {
+    if (node == AST_NONE) {
+        return 0;  // invalid if condition is missing
     }
 
     // validate the condition expression
-    int condition_type = check_expression(node, table);
+    int condition_type = check_expression(ast, node, names);
     
     // condition must be a valid expression that resolves to an integer
     if (condition_type == -1) {
@@ -161,45 +269,97 @@ int check_condition(ASTNode* node, SymbolTable* table) {
 
     // conditions should resolve to an integer type
     if (condition_type != TYPE_INT) {
-        semantic_error(SEM_ERROR_TYPE_MISMATCH, "condition", node->token.line);
+        node_error(SEM_ERROR_TYPE_MISMATCH, "condition", ast, node);
         return 0;
     }
 
     return 1;
 }
 
+// The node a Ref repeats; any other node stands for itself
+static NodeId shared_node(const AST* ast, NodeId node) {
+    return ast->kind[node] == AST_REF ? ast->child[node] : node;
+}
+
+// Remembered check of the shared node, NULL if there is no memory for it
+static Memo* memo_of(const AST* ast, NodeId node) {
+    if (node >= memo_cap) {
+        // lazy blocks add nodes while the checker runs
+        size_t cap = ast->count;
+        Memo* grown = realloc(memo, cap * sizeof(Memo));
+        if (!grown) {
+            return NULL;
+        }
+        memset(grown + memo_cap, 0, (cap - memo_cap) * sizeof(Memo));
+        memo = grown;
+        memo_cap = cap;
+    }
+    return &memo[node];
+}
+
+// Type of the expression a Ref repeats
+static int check_shared(const AST* ast, NodeId ref, Resolution* names) {
+    NodeId node = ast->child[ref];
+    Memo* m = memo_of(ast, node);
+    if (m && m->checked) {
+        return m->type;
+    }
+
+    unsigned long reported_before = reported;
+    uint32_t outer_shared = site_shared;
+    uint32_t outer_here = site_here;
+    site_here = ast_token_here(ast, site_shared, site_here, ast->token[ref]);
+    site_shared = ast->token[node];
+    int type = check_expression(ast, node, names);
+    site_shared = outer_shared;
+    site_here = outer_here;
+
+    if (m && type != -1 && reported == reported_before) {
+        m->checked = 1;
+        m->type = type;
+    }
+    return type;
+}
+
 // Special Feature: Function Call Validation
-int check_function_call(ASTNode* node, SymbolTable* table) {
+int check_function_call(const AST* ast, NodeId node, Resolution* names) {
     // Ensure node is function call
-    if (node->type != AST_FUNCTIONCALL) {
+    if (ast->kind[node] != AST_FUNCTIONCALL) {
         return 1;
     }
 
     // Validate function being called is "factorial"
-    if (strcmp(node->token.lexeme, "factorial") != 0) {
-        semantic_error(SEM_ERROR_INVALID_OPERATION, node->token.lexeme, node->token.line);
+    if (ast->name[node] != intern_cstr("factorial")) {
+        node_error(SEM_ERROR_INVALID_OPERATION, intern_name(ast->name[node]), ast, node);
         return 0;
     }
 
     // Check exactly one argument provided
-    if (node->args == NULL) {
-        semantic_error(SEM_ERROR_FUNCTION_CALL_NO_ARGUMENTS, "factorial", node->token.line);
+    NodeId argument = ast->child[node];
+    if (argument == AST_NONE) {
+        node_error(SEM_ERROR_FUNCTION_CALL_NO_ARGUMENTS, "factorial", ast, node);
         return 0;
     }
-    // if more than one argument is passed, "right" will not be NULL.
-    if (node->args->right != NULL) {
-        semantic_error(SEM_ERROR_FUNCTION_CALL_TOO_MANY_ARGUMENTS, "factorial", node->token.line);
+    if (ast->sibling[argument] != AST_NONE) {
+        node_error(SEM_ERROR_FUNCTION_CALL_TOO_MANY_ARGUMENTS, "factorial", ast, node);
         return 0;
     }
 
     // Validate argument expression
-    int valid = check_expression(node->args, table);
-
-    // If argument is a number literal, check that it's non-negative
-    if (node->args->type == AST_NUMBER) {
-        int value = atoi(node->args->token.lexeme);
-        if (value < 0) {
-            semantic_error(SEM_ERROR_INVALID_ARGUMENT, "factorial", node->token.line);
+    int valid = check_expression(ast, argument, names) != -1;
+
+    // If argument is a negated number literal, check that it's non-negative
+    NodeId literal = shared_node(ast, argument);
+    int negative = 0;
+    while (ast->kind[literal] == AST_OPERATOR && ast->child[literal] != AST_NONE) {
+        negative ^= *TOKEN_TEXT(parser_source(), ast_token(ast, literal)) == '-';
+        literal = shared_node(ast, ast->child[literal]);
+    }
+    if (ast->kind[literal] == AST_NUMBER) {
+        // the literal is followed by a non-digit, which ends the conversion
+        long value = strtol(TOKEN_TEXT(parser_source(), ast_token(ast, literal)), NULL, 10);
+        if (negative && value > 0) {
+            node_error(SEM_ERROR_INVALID_ARGUMENT, "factorial", ast, node);
             valid = 0;
         }
     }
@@ -208,45 +368,92 @@ int check_function_call(ASTNode* node, SymbolTable* table) {
 }
 
 
+// Type of a binary operation: the operands must have the same type, and a
+// comparison is 1 or 0. Operators of the same precedence chain to the left
+// (a - b - c is (a - b) - c), so the left operands can be nested as deeply as
+// the expression is long; they are walked down iteratively and checked on the
+// way back up, in the order the recursion would check them.
+static int check_binary(const AST* ast, NodeId node, Resolution* names) {
+    NodeId* spine = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+
+    while (ast->kind[node] == AST_BINOP || ast->kind[node] == AST_COMP) {
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            NodeId* grown = realloc(spine, cap * sizeof(NodeId));
+            if (!grown) {
+                free(spine);
+                return -1;
+            }
+            spine = grown;
+        }
+        spine[count++] = node;
+        node = ast->child[node];
+    }
+
+    int type = check_expression(ast, node, names); // the leftmost operand
+    while (count > 0) {
+        NodeId op = spine[--count];
+        int right_type = check_expression(ast, ast->sibling[ast->child[op]], names);
+        if (type == -1 || right_type == -1) {
+            type = -1;
+        } else if (type != right_type) {
+            // check if the types of the left and right expressions are the same
+            Token token = ast_token(ast, op);
+            char op_text[3];
+            snprintf(op_text, sizeof(op_text), "%.*s", (int)token.length,
+                     TOKEN_TEXT(parser_source(), token));
+            token = token_here(ast, op);
+            semantic_error(SEM_ERROR_TYPE_MISMATCH, op_text, &token);
+            type = -1;
+        } else if (ast->kind[op] == AST_COMP) {
+            type = TYPE_INT;
+        }
+    }
+    free(spine);
+    return type;
+}
+
 // check the expression for type correctness
-int check_expression(ASTNode* node, SymbolTable* table) {
-    if (node == NULL) {
+int check_expression(const AST* ast, NodeId node, Resolution* names) {
+    if (node == AST_NONE) {
         return -1;
     }
 
-    switch (node->type) {
+    switch (ast->kind[node]) {
         case AST_NUMBER: // number literal is type int
             return TYPE_INT;
 
         case AST_IDENTIFIER:{
-            Symbol* symbol = lookup_symbol(table, node->token.lexeme);
-            if (!symbol) {
-                semantic_error(SEM_ERROR_UNDECLARED_VARIABLE, node->token.lexeme, node->token.line);
+            int symbol = names->symbol[node];
+            if (symbol < 0) {
+                node_error(SEM_ERROR_UNDECLARED_VARIABLE, intern_name(ast->name[node]), ast, node);
                 return -1;
             }
             // check if the variable has been initialized, warn.
-            if (!symbol->is_initialized) {
-                semantic_error(SEM_ERROR_UNINITIALIZED_VARIABLE, node->token.lexeme, node->token.line);
-                return symbol->type;
+            if (!initialized[symbol]) {
+                node_error(SEM_ERROR_UNINITIALIZED_VARIABLE, intern_name(ast->name[node]), ast, node);
+                return names->type[symbol];
             }
-            return symbol->type;
+            return names->type[symbol];
         }
-        case AST_BINOP: {
-            int left_type = check_expression(node->left, table);
-            int right_type = check_expression(node->right, table);
-            if (left_type == -1 || right_type == -1) {
-                return -1;
-            }
-            // check if the types of the left and right expressions are the same
-            if (left_type != right_type) {
-                semantic_error(SEM_ERROR_TYPE_MISMATCH, node->token.lexeme, node->token.line);
-                return -1;
+        case AST_OPERATOR: // prefix + or -: the type of the operand
+            while (ast->kind[node] == AST_OPERATOR) {
+                node = ast->child[node];
             }
-            return left_type;
-        }
+            return check_expression(ast, node, names);
+
+        case AST_REF:
+            return check_shared(ast, node, names);
+
+        case AST_BINOP:
+        case AST_COMP:
+            return check_binary(ast, node, names);
+
         case AST_FUNCTIONCALL: {
             // validate function calls, like factorial and such...
-            int valid = check_function_call(node, table);
+            int valid = check_function_call(ast, node, names);
             if (!valid) {
                 return -1;
             }
@@ -261,175 +468,163 @@ int check_expression(ASTNode* node, SymbolTable* table) {
 
 
 // check variable declaration
-int check_declaration(ASTNode* node, SymbolTable* table) {
-    if (node == NULL || node->type != AST_VARDECL) { // check if node is a variable declaration
+int check_declaration(const AST* ast, NodeId node, Resolution* names) {
+    if (ast->kind[node] != AST_VARDECL) { // check if node is a variable declaration
         return 1;
     }
 
-    const char* variable_name = node->token.lexeme; // get the variable name
+    int variable_name = ast->name[node]; // get the variable name
     
     // check if the variable has already been declared
-    Symbol* current = table->head;
-    while (current != NULL) {
-        if (strcmp(current->name, variable_name) == 0 && current->scope_level == table->current_scope) { // Here is the check for the existence of the variable
-            semantic_error(SEM_ERROR_REDECLARED_VARIABLE, variable_name, node->token.line);
-            return -1; // return -1 if the variable has already been declared
-        }
-        current = current->next;
+    int symbol = names->symbol[node];
+    if (symbol == SYMBOL_REDECLARED) {
+        node_error(SEM_ERROR_REDECLARED_VARIABLE, intern_name(variable_name), ast, node);
+        return -1; // return -1 if the variable has already been declared
     }
 
-    // add the variable to the symbol table
-    add_symbol(table, variable_name, TYPE_INT, node->token.line);
-    return TYPE_INT; // return the data type of the variable
+    // the resolver has added the variable to the symbol table
+    return names->type[symbol]; // return the data type of the variable
 }
 
 // check variable assignment
-int check_assignment(ASTNode* node, SymbolTable* table) {
-    if (node == NULL || node->type != AST_ASSIGN || node->left == NULL || node->right == NULL) { 
+int check_assignment(const AST* ast, NodeId node, Resolution* names) {
+    NodeId target = ast->child[node];
+    if (ast->kind[node] != AST_ASSIGN || target == AST_NONE || ast->sibling[target] == AST_NONE) {
         return -1;
     }
 
-    const char* variable_name = node->left->token.lexeme; // get the variable name
+    int variable_name = ast->name[target]; // get the variable name
 
-    // look up the variable in the symbol table
-    Symbol* symbol = lookup_symbol(table, variable_name);
-    if (!symbol) { 
-        semantic_error(SEM_ERROR_UNDECLARED_VARIABLE, variable_name, node->left->token.line);
+    // the variable the resolver found in the symbol table
+    int symbol = names->symbol[node];
+    if (symbol < 0) { 
+        node_error(SEM_ERROR_UNDECLARED_VARIABLE, intern_name(variable_name), ast, target);
         return -1;
     }
 
     // check if the type of the right hand side matches the type of the variable
-    int expression_type = check_expression(node->right, table);
+    int expression_type = check_expression(ast, ast->sibling[target], names);
     if (expression_type == -1) {
         return -1;
     }
     
     // check the variable's type and the expression type are compatible
-    if (symbol->type != expression_type) {
-        semantic_error(SEM_ERROR_TYPE_MISMATCH, variable_name, node->left->token.line);
+    if (names->type[symbol] != expression_type) {
+        node_error(SEM_ERROR_TYPE_MISMATCH, intern_name(variable_name), ast, target);
         return -1;
     }
 
     // mark the variable as initialized
-    symbol->is_initialized = 1;
+    initialized[symbol] = 1;
     return expression_type;
 }
 
-// check a block of statements, handling scope
-int check_block(ASTNode* node, SymbolTable* table) {
-    if (node == NULL || node->type != AST_BLOCK) {
-        return 1;  // if not a block, return success
-    }
-
-    // enter a new scope for the block
-    enter_scope(table);
-
-    // validate the statements within the block
-    int valid = check_statement(node->left, table);
+// check node and the statements in it, walking down into blocks and the
+// bodies of if, while and repeat; the walk takes no C stack, so any nesting
+// the parser builds can be checked
+int check_statement(const AST* ast, NodeId node, Resolution* names) {
+    int valid = 1;
+    AstWalk walk;
+    AstVisit visit;
 
-    // exit the scope, removing block-level variables
-    exit_scope(table);
+    ast_walk_init(&walk, ast, node, 0);
+    while (ast_walk_next(&walk, &visit)) {
+        node = visit.node;
 
-    return valid;
-}
+        if (visit.event == AST_LEAVE) {
+            if (ast->kind[node] == AST_REPEAT) {
+                // the condition is checked after the body
+                valid &= check_condition(ast, ast->sibling[ast->child[node]], names);
+            }
+            continue;
+        }
 
+        if (ast_is_condition(ast, visit.parent, node)) {
+            ast_walk_skip(&walk); // checked along with its statement
+            continue;
+        }
 
-// enhanced check_statement to improve flow control validation
-int check_statement(ASTNode* node, SymbolTable* table) {
-    if (node == NULL) {
-        return 1;
-    }
+        switch (ast->kind[node]) {
+            case AST_VARDECL:
+                valid &= (check_declaration(ast, node, names) != -1);
+                break;
 
-    int valid = 1;
+            case AST_ASSIGN:
+                valid &= (check_assignment(ast, node, names) != -1);
+                ast_walk_skip(&walk);
+                break;
 
-    switch (node->type) {
-        case AST_VARDECL:
-            valid &= (check_declaration(node, table) != -1);
-            break;
+            case AST_PRINT:
+                valid &= (check_expression(ast, ast->child[node], names) != -1);
+                ast_walk_skip(&walk);
+                break;
 
-        case AST_ASSIGN:
-            valid &= (check_assignment(node, table) != -1);
-            break;
-    
-        case AST_PRINT:
-            valid &= (check_expression(node->left, table) != -1);
-            break;
-    
-        case AST_BLOCK:
-            valid &= check_block(node, table);
-            break;
-    
-        case AST_IF: {
-            // validate condition
-            valid &= check_condition(node->left, table);
-            
-            // validate then branch
-            if (node->right) {
-                enter_scope(table);
-                valid &= check_statement(node->right, table);
-                exit_scope(table);
-            } else {
-                // if statement must have a body
-                semantic_error(SEM_ERROR_INVALID_OPERATION, "if statement", node->token.line);
+            case AST_LAZY_BLOCK:
+                // the resolver had no memory to parse it
                 valid = 0;
+                break;
+
+            case AST_IF:
+            case AST_WHILE: {
+                // condition and body; without a condition the body is the only child
+                NodeId condition = ast->child[node];
+                if (ast->sibling[condition] == AST_NONE) {
+                    condition = AST_NONE;
+                }
+                valid &= check_condition(ast, condition, names);
+                break;
             }
-            break;
-        }
-    
-        case AST_WHILE: {
-            // validate condition
-            valid &= check_condition(node->left, table);
-            
-            // validate loop body
-            if (node->right) {
-                enter_scope(table);
-                valid &= check_statement(node->right, table);
-                exit_scope(table);
-            } else {
-                // while loop must have a body
-                semantic_error(SEM_ERROR_INVALID_OPERATION, "while loop", node->token.line);
-                valid = 0;
-            }
-            break;
-        }
-    
-        case AST_REPEAT: {
-            // validate loop body first
-            if (node->left) {
-                enter_scope(table);
-                valid &= check_statement(node->left, table);
-                exit_scope(table);
-            } else {
-                // repeat loop must have a body
-                semantic_error(SEM_ERROR_INVALID_OPERATION, "repeat loop", node->token.line);
+
+            case AST_FUNCTIONCALL:
+                // validate function declaration
+                valid &= check_function_call(ast, node, names);
+                ast_walk_skip(&walk);
+                break;
+
+            case AST_ERROR:
+                // a syntax error, which the parser has reported
                 valid = 0;
-            }
+                break;
 
-            // then validate condition
-            valid &= check_condition(node->right, table);
-            break;
+            default:
+                // the program, blocks, repeat, or the parts of an expression
+                // used as a statement
+                break;
         }
-    
-        case AST_FUNCTIONCALL:
-            // validate function declaration
-            valid &= (check_function_call(node, table) != -1);
-            break;
-    
-        default:
-            // recursively check left and right children
-            valid &= check_statement(node->left, table);
-            valid &= check_statement(node->right, table);
-            break;
     }
-    
+    if (walk.out_of_memory) {
+        fprintf(stderr, "Out of memory\n");
+        valid = 0;
+    }
+    ast_walk_free(&walk);
     return valid;
 }
 
+int analyze_resolved(const AST* ast, Resolution* names) {
+    initialized = calloc(names->count > 0 ? names->count : 1, 1);
+    if (!initialized) {
+        fprintf(stderr, "Out of memory\n");
+        return 0;
+    }
+    int result = check_statement(ast, AST_ROOT, names);
+    free(initialized);
+    initialized = NULL;
+    free(memo);
+    memo = NULL;
+    memo_cap = 0;
+    return result;
+}
+
 // semantic analysis function
-int analyze_semantics(ASTNode* ast) {
-    SymbolTable* table = init_symbol_table();
-    int result = check_statement(ast, table);
-    free_symbol_table(table);
+int analyze_semantics(AST* ast) {
+    Resolution names;
+    if (!resolve_names(ast, &names)) {
+        fprintf(stderr, "Out of memory\n");
+        free_resolution(&names);
+        return 0;
+    }
+    int result = analyze_resolved(ast, &names);
+    free_resolution(&names);
     return result;
 }
 
@@ -459,33 +654,3 @@ int analyze_semantics(ASTNode* ast) {
 //     return 0;
 // }
 
-
-int main() {
-    const char* input = "int x;\n"
-                        "x = 42;\n";
-    printf("Analyzing input:\n%s\n\n", input);
-    
-    // Lexical analysis and parsing
-    parser_init(input);
-    ASTNode* ast = parse();
-    
-    printf("AST created. Performing semantic analysis...\n\n");
-    
-    // Semantic analysis
-    int result = analyze_semantics(ast);
-    
-    if (result) {
-        printf("Semantic analysis successful. No errors found.\n");
-    } else {
-        printf("Semantic analysis failed. Errors detected.\n");
-    }
-    
-    // Clean up
-    free_ast(ast);
-    
-    return 0;
-}
-
-
-
-
@@ -0,0 +1,240 @@
+/* xref.c - where symbols are declared and used */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/xref.h"
+#include "../../include/lexer.h"
+
+typedef struct {
+    NodeId node;
+    uint32_t shared;        // token of the shared expression the walk is in
+    uint32_t here;          // token of the Ref that repeats it; equal outside Refs
+} Pending;
+
+typedef struct {
+    uint32_t start;
+    uint32_t length;
+    int symbol;
+    int declaration;
+} Occurrence;
+
+static Pending* pending;            // nodes left to visit
+static size_t pending_count;
+static size_t pending_cap;
+static Occurrence* found;           // declarations and uses, in the order they are met
+static size_t found_count;
+static size_t found_cap;
+
+static int push(NodeId node, uint32_t shared, uint32_t here) {
+    if (pending_count == pending_cap) {
+        size_t cap = pending_cap ? pending_cap * 2 : 256;
+        Pending* grown = realloc(pending, cap * sizeof(Pending));
+        if (!grown) {
+            return 0;
+        }
+        pending = grown;
+        pending_cap = cap;
+    }
+    pending[pending_count++] = (Pending){node, shared, here};
+    return 1;
+}
+
+static int record(Token token, int symbol, int declaration) {
+    if (found_count == found_cap) {
+        size_t cap = found_cap ? found_cap * 2 : 1024;
+        Occurrence* grown = realloc(found, cap * sizeof(Occurrence));
+        if (!grown) {
+            return 0;
+        }
+        found = grown;
+        found_cap = cap;
+    }
+    found[found_count++] = (Occurrence){token.offset, token.length, symbol, declaration};
+    return 1;
+}
+
+// Collect the declarations and uses under the root in source order; 0 if out
+// of memory
+static int collect(const AST* ast, const Resolution* names) {
+    pending_count = 0;
+    found_count = 0;
+    if (!push(AST_ROOT, 0, 0)) {
+        return 0;
+    }
+    while (pending_count > 0) {
+        Pending at = pending[--pending_count];
+        NodeId node = at.node;
+        uint8_t kind = ast->kind[node];
+
+        if (kind == AST_REF) {
+            NodeId shared = ast->child[node];
+            uint32_t here = ast_token_here(ast, at.shared, at.here, ast->token[node]);
+            if (!push(shared, ast->token[shared], here)) {
+                return 0;
+            }
+            continue;
+        }
+        if (kind == AST_LAZY_BLOCK) {
+            continue; // never parsed, so nothing in it was resolved
+        }
+
+        int symbol = node < names->nodes ? names->symbol[node] : SYMBOL_UNRESOLVED;
+        if (symbol >= 0 && (kind == AST_VARDECL || kind == AST_IDENTIFIER) &&
+            !record(token_buffer_get(ast->tokens, ast_token_here(ast, at.shared, at.here, ast->token[node])),
+                    symbol, kind == AST_VARDECL)) {
+            return 0;
+        }
+
+        // the children, pushed so that the first comes off first
+        size_t first = pending_count;
+        for (NodeId child = ast->child[node]; child != AST_NONE; child = ast->sibling[child]) {
+            if (!push(child, at.shared, at.here)) {
+                return 0;
+            }
+        }
+        for (size_t i = first, j = pending_count; i + 1 < j; i++, j--) {
+            Pending swap = pending[i];
+            pending[i] = pending[j - 1];
+            pending[j - 1] = swap;
+        }
+    }
+    return 1;
+}
+
+static int by_start(const void* a, const void* b) {
+    const Occurrence* x = a;
+    const Occurrence* y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+// Lay out the index from what collect found
+static int fill(XrefIndex* index, const Resolution* names) {
+    int symbols = names->count;
+    index->symbols = symbols;
+    index->declared_at = malloc((symbols > 0 ? symbols : 1) * sizeof(uint32_t));
+    index->name_length = calloc(symbols > 0 ? symbols : 1, sizeof(uint32_t));
+    index->use_start = calloc((size_t)symbols + 1, sizeof(uint32_t));
+    index->spans = malloc((found_count > 0 ? found_count : 1) * sizeof(XrefSpan));
+    if (!index->declared_at || !index->name_length || !index->use_start || !index->spans) {
+        return 0;
+    }
+    if (symbols > 0) {
+        memcpy(index->declared_at, names->declared_at, symbols * sizeof(uint32_t));
+    }
+
+    // the walk meets them in source order unless lazy blocks or Refs that
+    // stand in for a name got in the way
+    size_t i = 1;
+    while (i < found_count && found[i - 1].start <= found[i].start) i++;
+    if (i < found_count) {
+        qsort(found, found_count, sizeof(Occurrence), by_start);
+    }
+
+    // spans, one per stretch of text; counting the uses of each symbol
+    size_t count = 0;
+    for (i = 0; i < found_count; i++) {
+        Occurrence* o = &found[i];
+        if (count > 0 && index->spans[count - 1].start == o->start) {
+            o->symbol = SYMBOL_NONE; // a Ref standing in for another name
+            continue;
+        }
+        index->spans[count++] = (XrefSpan){o->start, o->start + o->length, o->symbol};
+        if (o->declaration) {
+            index->name_length[o->symbol] = o->length;
+        } else {
+            index->use_start[o->symbol + 1]++;
+        }
+    }
+    index->span_count = count;
+    for (int s = 0; s < symbols; s++) {
+        index->use_start[s + 1] += index->use_start[s];
+    }
+
+    // the uses, each symbol's after the ones before it, still in source order
+    index->use_count = index->use_start[symbols];
+    index->uses = malloc((index->use_count > 0 ? index->use_count : 1) * sizeof(uint32_t));
+    uint32_t* next = malloc((symbols > 0 ? symbols : 1) * sizeof(uint32_t));
+    if (!index->uses || !next) {
+        free(next);
+        return 0;
+    }
+    if (symbols > 0) {
+        memcpy(next, index->use_start, symbols * sizeof(uint32_t));
+    }
+    for (i = 0; i < found_count; i++) {
+        if (found[i].symbol >= 0 && !found[i].declaration) {
+            index->uses[next[found[i].symbol]++] = found[i].start;
+        }
+    }
+    free(next);
+    return 1;
+}
+
+int xref_build(XrefIndex* index, const AST* ast, const Resolution* names) {
+    memset(index, 0, sizeof(XrefIndex));
+    int ok = collect(ast, names) && fill(index, names);
+    if (!ok) {
+        xref_free(index);
+    }
+
+    free(pending);
+    pending = NULL;
+    pending_count = pending_cap = 0;
+    free(found);
+    found = NULL;
+    found_count = found_cap = 0;
+    return ok;
+}
+
+void xref_free(XrefIndex* index) {
+    free(index->declared_at);
+    free(index->name_length);
+    free(index->use_start);
+    free(index->uses);
+    free(index->spans);
+    memset(index, 0, sizeof(XrefIndex));
+}
+
+int xref_symbol_at(const XrefIndex* index, size_t offset) {
+    // last span starting at or before offset
+    size_t lo = 0;
+    size_t hi = index->span_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->spans[mid].start <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0 || offset >= index->spans[lo - 1].end) {
+        return SYMBOL_NONE;
+    }
+    return index->spans[lo - 1].symbol;
+}
+
+uint32_t xref_definition(const XrefIndex* index, int symbol) {
+    return index->declared_at[symbol];
+}
+
+const uint32_t* xref_uses(const XrefIndex* index, int symbol, size_t* count) {
+    *count = index->use_start[symbol + 1] - index->use_start[symbol];
+    return index->uses + index->use_start[symbol];
+}
+
+int analyze_semantics_xref(AST* ast, XrefIndex* index) {
+    Resolution names;
+    memset(index, 0, sizeof(XrefIndex));
+    if (!resolve_names(ast, &names)) {
+        fprintf(stderr, "Out of memory\n");
+        free_resolution(&names);
+        return 0;
+    }
+    int result = analyze_resolved(ast, &names);
+    if (!xref_build(index, ast, &names)) {
+        fprintf(stderr, "Out of memory\n");
+        result = 0;
+    }
+    free_resolution(&names);
+    return result;
+}
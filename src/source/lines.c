@@ -0,0 +1,124 @@
+/* lines.c - offset to line/column lookup */
+#include <stdlib.h>
+#include <string.h>
+#include "../../include/lines.h"
+
+void line_index_init(LineIndex *index, const char *text, size_t size) {
+    index->text = text;
+    index->size = size;
+    index->starts = NULL;
+    index->count = 0;
+}
+
+size_t count_newlines(const char *text, size_t size, size_t *line_start) {
+    const char *p = text;
+    const char *end = text + size;
+    size_t n = 0;
+    // memchr is vectorized by the C library, which beats a byte loop by far
+    // on the usual 20-80 byte lines
+    while (p < end && (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        n++;
+        p++;
+        *line_start = (size_t)(p - text);
+    }
+    return n;
+}
+
+// Record where every line starts; returns 0 if out of memory
+static int build(LineIndex *index) {
+    size_t cap = index->size / 32 + 16;
+    uint32_t *starts = malloc(cap * sizeof(uint32_t));
+    if (!starts) return 0;
+
+    const char *text = index->text;
+    const char *end = text + index->size;
+    const char *p = text;
+    size_t count = 0;
+    starts[count++] = 0;
+    while (p < end && (p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        p++;
+        if (count == cap) {
+            cap *= 2;
+            uint32_t *grown = realloc(starts, cap * sizeof(uint32_t));
+            if (!grown) {
+                free(starts);
+                return 0;
+            }
+            starts = grown;
+        }
+        starts[count++] = (uint32_t)(p - text);
+    }
+
+    index->starts = starts;
+    index->count = count;
+    return 1;
+}
+
+SourceLocation line_index_locate(LineIndex *index, size_t offset) {
+    SourceLocation where;
+    if (offset > index->size) {
+        offset = index->size;
+    }
+
+    if (!index->starts && !build(index)) {
+        // no memory for the table: count the lines before offset instead
+        size_t line_start = 0;
+        where.line = 1 + (int)count_newlines(index->text, offset, &line_start);
+        where.column = (int)(offset - line_start) + 1;
+        return where;
+    }
+
+    // last line starting at or before offset
+    size_t lo = 0;
+    size_t hi = index->count;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (index->starts[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    where.line = (int)lo + 1;
+    where.column = (int)(offset - index->starts[lo]) + 1;
+    return where;
+}
+
+size_t line_index_offset(LineIndex *index, SourceLocation where) {
+    if (where.line < 1 || where.column < 1) {
+        return (size_t)-1;
+    }
+
+    size_t line_start = 0;
+    size_t line_end = index->size;
+    if (index->starts || build(index)) {
+        if ((size_t)where.line > index->count) {
+            return (size_t)-1;
+        }
+        line_start = index->starts[where.line - 1];
+        if ((size_t)where.line < index->count) {
+            line_end = index->starts[where.line] - 1;
+        }
+    } else {
+        // no memory for the table: walk the lines up to it instead
+        for (int line = 1; line < where.line; line++) {
+            const char *newline = memchr(index->text + line_start, '\n', index->size - line_start);
+            if (!newline) {
+                return (size_t)-1;
+            }
+            line_start = (size_t)(newline - index->text) + 1;
+        }
+        const char *newline = memchr(index->text + line_start, '\n', index->size - line_start);
+        if (newline) {
+            line_end = (size_t)(newline - index->text);
+        }
+    }
+
+    size_t offset = line_start + (size_t)where.column - 1;
+    return offset <= line_end ? offset : (size_t)-1;
+}
+
+void line_index_free(LineIndex *index) {
+    free(index->starts);
+    line_index_init(index, index->text, index->size);
+}
@@ -0,0 +1,137 @@
+/* source.c */
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../include/source.h"
+
+// Read everything from fd into a heap buffer (used for pipes and stdin)
+static int read_all(SourceFile* src, int fd) {
+    size_t cap = 64 * 1024;
+    size_t len = 0;
+    char* buf = malloc(cap + 1);
+    if (!buf) return -1;
+
+    for (;;) {
+        if (len == cap) {
+            char* grown = realloc(buf, cap * 2 + 1);
+            if (!grown) {
+                free(buf);
+                return -1;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            free(buf);
+            return -1;
+        }
+        if (n == 0) break;
+        len += (size_t)n;
+        if (len > INT_MAX) {
+            // as for a regular file: the lexer indexes the input with an int
+            free(buf);
+            errno = EFBIG;
+            return -1;
+        }
+    }
+
+    if (len == 0) {
+        free(buf);
+        src->data = "";
+        return 0;
+    }
+
+    buf[len] = '\0';
+    src->data = buf;
+    src->size = len;
+    src->map_size = 0;
+    return 0;
+}
+
+// Map a regular file read-only, making sure a '\0' follows the last byte.
+// The bytes between EOF and the end of its last page read as zero, so only a
+// file whose size is an exact multiple of the page size needs an extra page:
+// we reserve size + 1 bytes of zeroed anonymous memory and map the file over
+// the front of it.
+static int map_file(SourceFile* src, int fd, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t map_size = (size + 1 + page - 1) / page * page;
+
+    char* base = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return -1;
+
+    if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        int saved = errno;
+        munmap(base, map_size);
+        errno = saved;
+        return -1;
+    }
+    // We scan the file front to back exactly once
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    src->data = base;
+    src->size = size;
+    src->map_size = map_size;
+    return 0;
+}
+
+int source_open(SourceFile* src, const char* path) {
+    src->data = NULL;
+    src->size = 0;
+    src->map_size = 0;
+
+    if (strcmp(path, "-") == 0) {
+        return read_all(src, STDIN_FILENO);
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    int result;
+    if (!S_ISREG(st.st_mode)) {
+        result = read_all(src, fd);
+    } else if ((unsigned long long)st.st_size > INT_MAX) {
+        // The lexer indexes the input with an int
+        errno = EFBIG;
+        result = -1;
+    } else if (st.st_size == 0) {
+        src->data = "";
+        result = 0;
+    } else {
+        result = map_file(src, fd, (size_t)st.st_size);
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return result;
+}
+
+void source_close(SourceFile* src) {
+    if (src->map_size) {
+        munmap((void*)src->data, src->map_size);
+    } else if (src->size) {
+        free((void*)src->data);
+    }
+    src->data = NULL;
+    src->size = 0;
+    src->map_size = 0;
+}
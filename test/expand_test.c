@@ -0,0 +1,103 @@
+/* expand_test.c - ast_expand on a tree that is not the last one parsed
+ *
+ * Parses FILE with --lazy --share and expands every block of it, printing the
+ * syntax errors in the blocks, the tree and a hash of its node arrays. With a
+ * second file, that file is parsed (with sharing on too) between the parse of
+ * FILE and the expansion, so the parser's line index and table of shared
+ * expressions belong to the other file when FILE's blocks are parsed. The
+ * output must not change (OTHER should have no syntax errors, which would be
+ * printed too).
+ *
+ * Build it with the sources of src/lexer, src/parser, src/source and src/intern
+ * (test/run_tests.sh does this).
+ * Usage: expand_test FILE [OTHER]
+ */
+#include <stdio.h>
+#include "../include/source.h"
+#include "../include/intern.h"
+#include "../include/lexer.h"
+#include "../include/parser.h"
+
+// FNV-1a over the node arrays, as in bench/parse.c but with the spelling of
+// each name rather than its id, which depends on what was interned before
+static unsigned long long hash_tree(const AST* ast) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (size_t i = 0; i < ast->count; i++) {
+        unsigned long long v = ast->kind[i] + 7ULL * ast->child[i] + 131ULL * ast->sibling[i] +
+                               8191ULL * ast->token[i];
+        h = (h ^ v) * 1099511628211ULL;
+        if (ast->name[i] >= 0) {
+            for (const char* c = intern_name(ast->name[i]); *c; c++) {
+                h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+            }
+        }
+    }
+    return h;
+}
+
+static int lex(SourceFile* src, TokenBuffer* tokens, const char* path) {
+    if (source_open(src, path) != 0) {
+        perror(path);
+        return 0;
+    }
+    token_buffer_init(tokens, src->data);
+    if (!token_buffer_lex(tokens, src->data, src->size)) {
+        fprintf(stderr, "Out of memory\n");
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s file [other]\n", argv[0]);
+        return 2;
+    }
+    SourceFile src, other_src;
+    TokenBuffer tokens, other_tokens;
+    AST ast, other;
+    ast_init(&ast);
+    ast_init(&other);
+    parser_set_lazy(1);
+    parser_set_share(1);
+
+    if (!lex(&src, &tokens, argv[1])) {
+        return 1;
+    }
+    parser_init_tokens(&tokens);
+    if (!parse(&ast)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if (argc > 2) {
+        if (!lex(&other_src, &other_tokens, argv[2])) {
+            return 1;
+        }
+        parser_init_tokens(&other_tokens);
+        if (!parse(&other)) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+
+    // the count grows as blocks are expanded, and so reaches the inner ones
+    for (NodeId node = 0; node < ast.count; node++) {
+        if (ast.kind[node] == AST_LAZY_BLOCK && !ast_expand(&ast, node)) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+    print_ast(&ast, AST_ROOT, 0);
+    printf("%d syntax errors, %zu nodes, tree %016llx\n", ast.errors, ast.count, hash_tree(&ast));
+
+    ast_free(&ast);
+    ast_free(&other);
+    token_buffer_free(&tokens);
+    source_close(&src);
+    if (argc > 2) {
+        token_buffer_free(&other_tokens);
+        source_close(&other_src);
+    }
+    intern_free();
+    return 0;
+}
@@ -0,0 +1,229 @@
+#!/bin/sh
+# run_tests.sh - build the analyzer and check that its optional modes, and its
+# -D build variants, print what the plain run prints
+#
+# Usage, from anywhere: test/run_tests.sh [extra compiler flags]
+# e.g. test/run_tests.sh -fsanitize=undefined,address
+# Exits 1 if a check failed.
+
+cd "$(dirname "$0")/.." || exit 2
+build=$(mktemp -d) || exit 2
+trap 'rm -rf "$build"' EXIT
+CC=${CC:-gcc}
+
+echo "building with $CC -O2 -pthread $*"
+$CC -O2 -Wall -pthread "$@" -o "$build/semantic" src/*/*.c || exit 2
+semantic="$build/semantic"
+
+failed=0
+checks=0
+
+# same NAME FILE OPTIONS_A OPTIONS_B: stdout of both runs must be identical
+same() {
+    same_builds "$1" "$2" "$semantic" "$3" "$semantic" "$4"
+}
+
+# same_builds NAME FILE BINARY_A OPTIONS_A BINARY_B OPTIONS_B: the same, for
+# runs of two builds
+same_builds() {
+    checks=$((checks + 1))
+    $3 $4 "$2" > "$build/a" 2> "$build/a.err"
+    $5 $6 "$2" > "$build/b" 2> "$build/b.err"
+    if ! cmp -s "$build/a" "$build/b"; then
+        failed=$((failed + 1))
+        echo "FAIL $1: $2 with '$4' and '$6' differ"
+        diff "$build/a" "$build/b" | head -10
+    fi
+    if grep -q "runtime error" "$build/a.err" "$build/b.err"; then
+        failed=$((failed + 1))
+        echo "FAIL $1: $2: sanitizer report"
+        grep -h "runtime error" "$build/a.err" "$build/b.err" | head -3
+    fi
+}
+
+# same_lines NAME FILE OPTIONS_A OPTIONS_B: the same lines, in any order
+same_lines() {
+    checks=$((checks + 1))
+    $semantic $3 "$2" 2> /dev/null | sort > "$build/a"
+    $semantic $4 "$2" 2> /dev/null | sort > "$build/b"
+    if ! cmp -s "$build/a" "$build/b"; then
+        failed=$((failed + 1))
+        echo "FAIL $1: $2 with '$3' and '$4' differ"
+        diff "$build/a" "$build/b" | head -10
+    fi
+}
+
+# Shared expressions: every diagnostic at the same line and column
+for f in test/input_*.txt; do
+    same share "$f" "" "--share"
+    same lazy-share "$f" "--lazy" "--lazy --share"
+done
+
+# Cross references: a variable's declaration and uses, each at its own place
+# in a shared expression, from a place in it or in a Ref to it
+for at in 1:5 2:5 5:7 8:9 8:14 9:11 13:13 16:11 4:9; do
+    same xref-share test/input_xref.txt "--xref=$at" "--xref=$at --share"
+    same xref-lazy-share test/input_xref.txt "--xref=$at --lazy" "--xref=$at --lazy --share"
+done
+
+# Lazy blocks: the same diagnostics, though those in blocks may come later
+for f in test/input_*.txt; do
+    same_lines lazy "$f" "" "--lazy"
+done
+
+# ast_expand on a tree after another file was parsed
+checks=$((checks + 1))
+if ! $CC -O2 -Wall "$@" -o "$build/expand_test" test/expand_test.c \
+         src/lexer/*.c src/parser/*.c src/source/*.c src/intern/*.c ||
+   ! "$build/expand_test" test/input_lazy.txt > "$build/a" ||
+   ! "$build/expand_test" test/input_lazy.txt test/input_shared.txt > "$build/b" ||
+   ! cmp -s "$build/a" "$build/b"; then
+    failed=$((failed + 1))
+    echo "FAIL expand after another parse"
+    diff "$build/a" "$build/b" | head -10
+fi
+
+# Image cache: the run that saves an image and the next one, which maps it
+# instead of lexing and parsing, print what a run without the cache prints.
+# A file that parses without errors must be saved, and then loaded
+for f in test/input_*.txt; do
+    for options in "" "--share" "--lazy" "--lazy --share"; do
+        rm -rf "$build/cache" && mkdir "$build/cache" || exit 2
+        same cache-save "$f" "$options" "$options --cache=$build/cache"
+        saved=$(grep -c "^  save " "$build/b.err")
+        same cache-load "$f" "$options" "$options --cache=$build/cache"
+        checks=$((checks + 1))
+        if [ "$saved" -eq 0 ] && ! grep -q "Parse Error" "$build/a"; then
+            failed=$((failed + 1))
+            echo "FAIL cache: $f with '$options' saved no image"
+        elif [ "$saved" -gt 0 ] && ! grep -q "^  load " "$build/b.err"; then
+            failed=$((failed + 1))
+            echo "FAIL cache: $f with '$options' did not load its image"
+        fi
+    done
+done
+
+# AST emitters
+for f in test/input_*.txt; do
+    for format in text json dot; do
+        same "ast-$format" "$f" "--ast=$format" "--ast=$format --pipeline"
+    done
+done
+
+# The explicit-stack parser (-DPARSER_STACK) makes the trees the recursive one
+# makes, syntax errors and stray '}'s included
+$CC -O2 -Wall -pthread "$@" -DPARSER_STACK -o "$build/semantic-stack" src/*/*.c || exit 2
+for f in test/input_*.txt; do
+    for options in "--ast" "--ast --lazy" "--ast --share" "--ast=json --lazy --share"; do
+        same_builds parser-stack "$f" "$semantic" "$options" "$build/semantic-stack" "$options"
+    done
+done
+
+# Scan kernels: the vector scanners stop where the scalar ones do, and the
+# lexer makes the same tokens with each set
+checks=$((checks + 1))
+if ! $CC -O2 -Wall "$@" -o "$build/scan_test" test/scan_test.c src/lexer/scan.c src/lexer/utf8.c ||
+   ! "$build/scan_test"; then
+    failed=$((failed + 1))
+    echo "FAIL scan kernels"
+fi
+
+# words, comments and numbers of every length up to a few blocks
+awk 'BEGIN {
+    for (n = 1; n <= 80; n++) {
+        s = ""; for (i = 0; i < n; i++) s = s substr("abcXYZ_09", i % 9 + 1, 1)
+        print "int v" s "; // " s
+        printf "/* %s */ v%s = %s;%s\n", s, s, substr("1234567890123456789", 1, n % 19 + 1), substr("          ", 1, n % 10)
+    }
+}' > "$build/input_lengths.txt"
+for set in sse2 avx2; do
+    if ! $semantic --lex-only --simd=$set test/input_valid.txt > /dev/null 2>&1; then
+        echo "$set kernels not available here, skipped"
+        continue
+    fi
+    for f in test/input_*.txt "$build/input_lengths.txt"; do
+        same "tokens-$set" "$f" "--lex-only --tokens --simd=scalar" "--lex-only --tokens --simd=$set"
+    done
+done
+
+# The table-driven lexer (-DLEXER_DFA) makes the tokens the hand-written one
+# makes
+$CC -O2 -Wall -pthread "$@" -DLEXER_DFA -o "$build/semantic-dfa" src/*/*.c || exit 2
+for f in test/input_*.txt "$build/input_lengths.txt"; do
+    same_builds tokens-dfa "$f" "$semantic" "--lex-only --tokens" "$build/semantic-dfa" "--lex-only --tokens"
+done
+
+# Threads and --stream: lex_parallel cuts the input into chunks of at least
+# 64 KB, so this input is 1.6 MB, mostly block comments and strings that run
+# across line starts, where a chunk can begin. A quote in a comment or a comment opener in
+# a string keeps a run lexing in the wrong state going, some for longer than
+# the 16 KB a speculative run tries, and the input ends inside one that is
+# never closed.
+for end in comment string; do
+    awk -v end=$end '
+function words(n,    s) {
+    s = ""
+    while (length(s) < n) s = s " " substr("int x = y + 1 ; while { } print", int(rand() * 20) + 1, int(rand() * 8) + 1)
+    return s
+}
+# lines of code without quotes or slashes, where lexing in the wrong state
+# does not get back in step
+function plain(n) {
+    for (; n > 0; n--) printf "x%d = x%d + %d;\n", n % 10, n % 10, n
+}
+BEGIN {
+    srand(1)
+    for (i = 0; i < 400; i++) {
+        r = rand()
+        big = r > 0.9
+        lines = big ? 300 : int(rand() * 30) + 1
+        if (r < 0.4) {
+            printf "x%d = x%d + %d; print \"s%d\"; // a /* or a \" here\n", i % 40, i % 40, i, i
+        } else if (r < 0.65 || (big && r < 0.95)) {
+            # a block comment with a quote in it
+            printf "/*"
+            for (k = 0; k < lines; k++) print words(60) (k == lines - 2 ? " \"" : "")
+            print "*/ x = 1;"
+        } else {
+            # a string with a comment opener in it
+            printf "print \""
+            for (k = 0; k < lines; k++) print words(60) (k == lines - 2 ? " /*" : k == 0 ? " \\\"" : "")
+            print "\";"
+        }
+        if (big) plain(1500)
+    }
+    # never closed
+    printf end == "comment" ? "/* the end" : "print \"the end"
+    for (k = 0; k < 20; k++) print words(60)
+}' > "$build/input_chunks_$end.txt"
+    for n in 2 3 4 7 16; do
+        same "threads-$n" "$build/input_chunks_$end.txt" "--lex-only --tokens" "--lex-only --tokens --threads=$n"
+    done
+    # its lexemes fit in the 64 KB window of --stream, many across its refills
+    same stream "$build/input_chunks_$end.txt" "--lex-only --tokens" "--stream --tokens"
+done
+
+# Tokens longer than the --stream window are lexed on past it, but their lexeme
+# is not kept: the same tokens, lines and errors, with the lexemes left out
+awk 'BEGIN {
+    for (i = 0; i < 70000; i++) {
+        word = word substr("abc_9", i % 5 + 1, 1)
+        number = number (i % 10)
+    }
+    for (i = 0; i < 7000; i++) text = text "\303\251 \\\" 0123"
+    print "int " word ";\nx = " number ";"
+    print "print \"" text "\";"
+    print "print \"" text "\\"      # never closed, and the newline escaped
+    print "x = 1;"
+}' > "$build/input_long.txt"
+checks=$((checks + 1))
+$semantic --lex-only --tokens "$build/input_long.txt" 2> /dev/null | sed "s/| Lexeme: .* | Line/| Line/" > "$build/a"
+$semantic --stream --tokens "$build/input_long.txt" 2> /dev/null | sed "s/| Lexeme: .* | Line/| Line/" > "$build/b"
+if ! cmp -s "$build/a" "$build/b"; then
+    failed=$((failed + 1))
+    echo "FAIL stream: tokens longer than the window differ"
+    diff "$build/a" "$build/b" | head -10
+fi
+
+echo "$checks checks, $failed failed"
+[ "$failed" -eq 0 ]
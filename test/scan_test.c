@@ -0,0 +1,165 @@
+/* scan_test.c - the vector scanners against the scalar ones
+ *
+ * Every scanner of every kernel set this CPU has is run on the same inputs as
+ * the scalar set and must stop at the same byte. The inputs are runs of every
+ * length up to a few blocks, starting at every offset in a 64-byte line, so
+ * they straddle the 16 and 32 byte block boundaries in every way. Runs also
+ * end right at the end of a page whose next page is unmapped, where the
+ * aligned loads read up to the page end and must not go further.
+ *
+ * Build and run (test/run_tests.sh does this):
+ *   gcc -O2 -o scan_test test/scan_test.c src/lexer/scan.c src/lexer/utf8.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../include/scan.h"
+
+#define MAX_RUN 100                 // longest run tried, a few AVX2 blocks
+#define LINE 64                     // start offsets tried
+
+typedef struct {
+    const char* name;
+    const char* (**scan)(const char* p);
+    const char* run;                // bytes the run is made of, cycled
+    const char* stop;               // what ends it
+} Case;
+
+static const Case cases[] = {
+    {"whitespace", &scan_whitespace, " \t\n\r", "x"},
+    {"line comment", &scan_line_comment, "a */ / *\t\xc3\xa9", "\n"},
+    {"block comment", &scan_block_comment, "a * / \n*\x7f/", "*/"},
+    {"block comment, '*' before the end", &scan_block_comment, "ab**", "*/"},
+    {"word", &scan_word, "abc_XYZ019", " "},
+    {"word before an operator", &scan_word, "q_9", "+"},
+    {"digits", &scan_digits, "0123456789", "a"},
+};
+
+static const char* kernel_sets[] = {"sse2", "avx2"};
+
+static int failures;
+
+// Write a run of length bytes of c->run at p, then c->stop and '\0' if
+// stopped, or only '\0'. The run strings never have "*/" where the cycle
+// wraps, so a block comment does not close early
+static void make_run(char* p, const Case* c, size_t length, int stopped) {
+    size_t cycle = strlen(c->run);
+    for (size_t i = 0; i < length; i++) {
+        p[i] = c->run[i % cycle];
+    }
+    size_t stop = stopped ? strlen(c->stop) : 0;
+    memcpy(p + length, c->stop, stop);
+    p[length + stop] = '\0';
+}
+
+// Where the scanner of the current set and the scalar one stop on p
+static void compare(const Case* c, const char* set, const char* p, const char* what, size_t length) {
+    const char* got = (*c->scan)(p);
+    scan_select("scalar");
+    const char* want = (*c->scan)(p);
+    scan_select(set);
+    if (got != want) {
+        failures++;
+        fprintf(stderr, "FAIL %s %s, %s, run of %zu at %p: stops at %td, scalar at %td\n",
+                set, c->name, what, length, (const void*)p, got - p, want - p);
+    }
+}
+
+// Runs of every length at every start offset of a cache line
+static void check_alignments(const char* set) {
+    static char buf[LINE + MAX_RUN + 64] __attribute__((aligned(64)));
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+        const Case* c = &cases[k];
+        for (size_t start = 0; start < LINE; start++) {
+            for (size_t length = 0; length <= MAX_RUN; length++) {
+                memset(buf, '@', sizeof(buf));
+                make_run(buf + start, c, length, 1);
+                compare(c, set, buf + start, "aligned buffer", length);
+
+                // the terminator right after the run, no stop
+                memset(buf, '@', sizeof(buf));
+                make_run(buf + start, c, length, 0);
+                compare(c, set, buf + start, "terminator", length);
+            }
+        }
+    }
+}
+
+// Runs whose terminator is the last byte of a page followed by an unmapped
+// page: a load past that page would fault
+static void check_page_end(const char* set) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char* mem = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED || mprotect(mem + page, page, PROT_NONE) != 0) {
+        fprintf(stderr, "cannot map a guard page, page end checks skipped\n");
+        return;
+    }
+    char* end = mem + page;         // first byte that cannot be read
+    for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+        const Case* c = &cases[k];
+        for (size_t length = 0; length <= MAX_RUN; length++) {
+            // run, then '\0' as the page's last byte
+            char* p = end - 1 - length;
+            memset(mem, '@', page);
+            make_run(p, c, length, 0);
+            compare(c, set, p, "ending at a page end", length);
+
+            // run and stop, then '\0' as the page's last byte
+            size_t stop = strlen(c->stop);
+            p = end - 1 - stop - length;
+            memset(mem, '@', page);
+            make_run(p, c, length, 1);
+            compare(c, set, p, "stop at a page end", length);
+        }
+    }
+    munmap(mem, 2 * page);
+}
+
+// UTF-8 validation of every length, good text and text with a bad byte at
+// every place
+static void check_utf8(const char* set) {
+    static const char* text = "a\xc3\xa9z\xe2\x82\xac\xf0\x9f\x98\x80 ascii only here.";
+    char buf[LINE + MAX_RUN + 64];
+    size_t cycle = strlen(text);
+    for (size_t start = 0; start < LINE; start += 7) {
+        for (size_t length = 0; length <= MAX_RUN; length++) {
+            for (size_t bad = 0; bad <= length; bad++) {
+                for (size_t i = 0; i < length; i++) {
+                    buf[start + i] = text[i % cycle];
+                }
+                if (bad < length) {
+                    buf[start + bad] = (char)0xff;
+                }
+                int got = scan_utf8_valid(buf + start, length);
+                scan_select("scalar");
+                int want = scan_utf8_valid(buf + start, length);
+                scan_select(set);
+                if (got != want) {
+                    failures++;
+                    fprintf(stderr, "FAIL %s utf8, %zu bytes at +%zu, 0xff at %zu: %d, scalar %d\n",
+                            set, length, start, bad, got, want);
+                }
+            }
+        }
+    }
+}
+
+int main(void) {
+    int sets = 0;
+    for (size_t i = 0; i < sizeof(kernel_sets) / sizeof(kernel_sets[0]); i++) {
+        const char* set = kernel_sets[i];
+        if (!scan_select(set)) {
+            printf("scan: %s not available here, skipped\n", set);
+            continue;
+        }
+        sets++;
+        check_alignments(set);
+        check_page_end(set);
+        check_utf8(set);
+    }
+    printf("scan: %d kernel set%s checked against scalar, %d failure%s\n",
+           sets, sets == 1 ? "" : "s", failures, failures == 1 ? "" : "s");
+    return failures > 0;
+}